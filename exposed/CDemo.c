@@ -254,8 +254,267 @@ void Example2d()
     }
 }
 
+/*-----------------------------------------------------------------------------
+ * For the examples below: in group 1, a workplane 200 along the xy plane,
+ * with its origin at point 101.
+ *---------------------------------------------------------------------------*/
+static void AddWorkplane(void)
+{
+    Slvs_hGroup g = 1;
+    double qw, qx, qy, qz;
+
+    sys.param[sys.params++] = Slvs_MakeParam(1, g, 0.0);
+    sys.param[sys.params++] = Slvs_MakeParam(2, g, 0.0);
+    sys.param[sys.params++] = Slvs_MakeParam(3, g, 0.0);
+    sys.entity[sys.entities++] = Slvs_MakePoint3d(101, g, 1, 2, 3);
+    Slvs_MakeQuaternion(1, 0, 0,
+                        0, 1, 0, &qw, &qx, &qy, &qz);
+    sys.param[sys.params++] = Slvs_MakeParam(4, g, qw);
+    sys.param[sys.params++] = Slvs_MakeParam(5, g, qx);
+    sys.param[sys.params++] = Slvs_MakeParam(6, g, qy);
+    sys.param[sys.params++] = Slvs_MakeParam(7, g, qz);
+    sys.entity[sys.entities++] = Slvs_MakeNormal3d(102, g, 4, 5, 6, 7);
+    sys.entity[sys.entities++] = Slvs_MakeWorkplane(200, g, 101, 102);
+}
+
+/*-----------------------------------------------------------------------------
+ * An example of a sketch with redundant constraints. Each line is made
+ * vertical twice over, so removing any one of those four constraints fixes
+ * the sketch, and all of them should be reported.
+ *---------------------------------------------------------------------------*/
+int ExampleFailed()
+{
+    Slvs_hGroup g;
+    int i, j, bad = 0;
+    static const Slvs_hConstraint vertical[] = { 1, 2, 3, 4 };
+
+    AddWorkplane();
+
+    g = 2;
+    sys.param[sys.params++] = Slvs_MakeParam(11, g, 11.0);
+    sys.param[sys.params++] = Slvs_MakeParam(12, g, 52.0);
+    sys.entity[sys.entities++] = Slvs_MakePoint2d(301, g, 200, 11, 12);
+    sys.param[sys.params++] = Slvs_MakeParam(13, g, 11.0);
+    sys.param[sys.params++] = Slvs_MakeParam(14, g, 22.0);
+    sys.entity[sys.entities++] = Slvs_MakePoint2d(302, g, 200, 13, 14);
+    sys.entity[sys.entities++] = Slvs_MakeLineSegment(400, g,
+                                        200, 301, 302);
+
+    sys.param[sys.params++] = Slvs_MakeParam(15, g, 1.0);
+    sys.param[sys.params++] = Slvs_MakeParam(16, g, 22.0);
+    sys.entity[sys.entities++] = Slvs_MakePoint2d(303, g, 200, 15, 16);
+    sys.param[sys.params++] = Slvs_MakeParam(17, g, 1.0);
+    sys.param[sys.params++] = Slvs_MakeParam(18, g, 32.0);
+    sys.entity[sys.entities++] = Slvs_MakePoint2d(304, g, 200, 17, 18);
+    sys.entity[sys.entities++] = Slvs_MakeLineSegment(401, g,
+                                        200, 303, 304);
+
+    for(i = 0; i < 4; i++) {
+        sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+                                                vertical[i], g,
+                                                SLVS_C_VERTICAL,
+                                                200,
+                                                0.0,
+                                                0, 0, (i < 2) ? 400 : 401, 0);
+    }
+    sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+                                            5, g,
+                                            SLVS_C_PT_PT_DISTANCE,
+                                            200,
+                                            10.0,
+                                            303, 302, 0, 0);
+
+    sys.calculateFaileds = 1;
+    Slvs_Solve(&sys, g);
+
+    if(sys.result != SLVS_RESULT_INCONSISTENT) bad = 1;
+    printf("redundant: result %d, problematic constraints are:", sys.result);
+    for(i = 0; i < sys.faileds; i++) {
+        printf(" %d", sys.failed[i]);
+    }
+    printf("\n");
+    for(i = 0; i < 4; i++) {
+        int found = 0;
+        for(j = 0; j < sys.faileds; j++) {
+            if(sys.failed[j] == vertical[i]) found = 1;
+        }
+        if(!found) bad = 1;
+    }
+    if(bad) printf("redundant constraints not found\n");
+    return bad;
+}
+
+/*-----------------------------------------------------------------------------
+ * An example of solving a batch of scenarios at once. There are no
+ * constraints at all here, so each scenario should come back unchanged,
+ * with all of its params free.
+ *---------------------------------------------------------------------------*/
+int ExampleBatch()
+{
+    Slvs_hGroup g = 1;
+    double init[2][3] = { { 1.0, 2.0, 3.0 }, { -4.0, 5.0, -6.0 } };
+    double vals[2][3];
+    Slvs_Scenario scenario[2];
+    int i, j, bad = 0;
+
+    sys.param[sys.params++] = Slvs_MakeParam(1, g, 0.0);
+    sys.param[sys.params++] = Slvs_MakeParam(2, g, 0.0);
+    sys.param[sys.params++] = Slvs_MakeParam(3, g, 0.0);
+    sys.entity[sys.entities++] = Slvs_MakePoint3d(101, g, 1, 2, 3);
+
+    memcpy(vals, init, sizeof(vals));
+    memset(scenario, 0, sizeof(scenario));
+    for(i = 0; i < 2; i++) {
+        scenario[i].paramVal = vals[i];
+        scenario[i].failed   = CheckMalloc(50*sizeof(scenario[i].failed[0]));
+        scenario[i].faileds  = 50;
+    }
+
+    Slvs_SolveBatch(&sys, g, scenario, 2);
+
+    for(i = 0; i < 2; i++) {
+        if(scenario[i].result != SLVS_RESULT_OKAY || scenario[i].dof != 3) {
+            bad = 1;
+        }
+        printf("scenario %d: result %d, %d DOF, at (%.3f %.3f %.3f)\n", i,
+                scenario[i].result, scenario[i].dof,
+                vals[i][0], vals[i][1], vals[i][2]);
+        free(scenario[i].failed);
+    }
+    for(i = 0; i < 2; i++) {
+        for(j = 0; j < 3; j++) {
+            if(vals[i][j] != init[i][j]) bad = 1;
+        }
+    }
+    if(bad) printf("batch solve failed\n");
+    return bad;
+}
+
+/*-----------------------------------------------------------------------------
+ * A batch of constrained scenarios: two points at given distances from the
+ * origin and from each other, for many different distances and initial
+ * guesses. Some of those are degenerate (the triangle is flat), and some
+ * impossible. There are more scenarios than threads, and each must come out
+ * just as if we'd solved it by itself.
+ *---------------------------------------------------------------------------*/
+#define BATCH_SCENARIOS 64
+#define BATCH_PARAMS    11
+int ExampleBatchConstrained()
+{
+    static const double dims[][3] = {
+        { 10.0, 10.0, 10.0 },
+        { 10.0, 20.0, 15.0 },
+        { 30.0, 10.0, 25.0 },
+        { 10.0, 10.0, 20.0 },   /* collinear, so redundant */
+        { 10.0, 10.0, 50.0 },   /* impossible */
+        { 12.0,  5.0, 13.0 },
+    };
+    static double vals[BATCH_SCENARIOS][BATCH_PARAMS];
+    static double valA[BATCH_SCENARIOS][3];
+    Slvs_Scenario scenario[BATCH_SCENARIOS];
+    Slvs_hGroup g;
+    int i, j, k, bad = 0;
+
+    AddWorkplane();
+
+    g = 2;
+    sys.param[sys.params++] = Slvs_MakeParam(11, g, 0.0);
+    sys.param[sys.params++] = Slvs_MakeParam(12, g, 0.0);
+    sys.entity[sys.entities++] = Slvs_MakePoint2d(301, g, 200, 11, 12);
+    sys.param[sys.params++] = Slvs_MakeParam(13, g, 0.0);
+    sys.param[sys.params++] = Slvs_MakeParam(14, g, 0.0);
+    sys.entity[sys.entities++] = Slvs_MakePoint2d(302, g, 200, 13, 14);
+
+    sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+                                            1, g,
+                                            SLVS_C_PT_PT_DISTANCE,
+                                            200,
+                                            0.0,
+                                            101, 301, 0, 0);
+    sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+                                            2, g,
+                                            SLVS_C_PT_PT_DISTANCE,
+                                            200,
+                                            0.0,
+                                            101, 302, 0, 0);
+    sys.constraint[sys.constraints++] = Slvs_MakeConstraint(
+                                            3, g,
+                                            SLVS_C_PT_PT_DISTANCE,
+                                            200,
+                                            0.0,
+                                            301, 302, 0, 0);
+    sys.calculateFaileds = 1;
+
+    memset(scenario, 0, sizeof(scenario));
+    for(i = 0; i < BATCH_SCENARIOS; i++) {
+        for(j = 0; j < sys.params; j++) {
+            vals[i][j] = sys.param[j].val;
+        }
+        /* The two points start out in various places. */
+        vals[i][7]  =  3.0 + (i % 7);
+        vals[i][8]  =  1.0 + (i % 5);
+        vals[i][9]  = -2.0 - (i % 3);
+        vals[i][10] =  4.0 + (i % 11);
+        for(k = 0; k < 3; k++) {
+            valA[i][k] = dims[i % (sizeof(dims)/sizeof(dims[0]))][k];
+        }
+
+        scenario[i].paramVal = vals[i];
+        scenario[i].valA     = valA[i];
+        scenario[i].failed   = CheckMalloc(50*sizeof(scenario[i].failed[0]));
+        scenario[i].faileds  = 50;
+    }
+
+    Slvs_SolveBatch(&sys, g, scenario, BATCH_SCENARIOS);
+
+    for(i = 0; i < BATCH_SCENARIOS; i++) {
+        Slvs_Scenario *s = &scenario[i];
+        int ok = 1;
+
+        /* The workplane's params stay as they are. */
+        sys.param[7].val  =  3.0 + (i % 7);
+        sys.param[8].val  =  1.0 + (i % 5);
+        sys.param[9].val  = -2.0 - (i % 3);
+        sys.param[10].val =  4.0 + (i % 11);
+        for(k = 0; k < 3; k++) {
+            sys.constraint[k].valA = valA[i][k];
+        }
+        sys.faileds = 50;
+        Slvs_Solve(&sys, g);
+
+        if(s->result != sys.result || s->dof != sys.dof ||
+           s->faileds != sys.faileds)
+        {
+            ok = 0;
+        } else {
+            for(j = 0; j < s->faileds; j++) {
+                if(s->failed[j] != sys.failed[j]) ok = 0;
+            }
+        }
+        if(sys.result == SLVS_RESULT_OKAY) {
+            for(j = 0; j < sys.params; j++) {
+                double d = vals[i][j] - sys.param[j].val;
+                if(d > 1e-6 || d < -1e-6) ok = 0;
+            }
+        }
+        if(!ok) {
+            printf("scenario %d: result %d, %d DOF, %d failed; "
+                   "by itself: result %d, %d DOF, %d failed\n", i,
+                    s->result, s->dof, s->faileds,
+                    sys.result, sys.dof, sys.faileds);
+            bad = 1;
+        }
+        free(s->failed);
+    }
+    printf("%d scenarios solved in a batch\n", BATCH_SCENARIOS);
+    if(bad) printf("batch solve differs\n");
+    return bad;
+}
+
 int main()
 {
+    int bad;
+
     sys.param      = CheckMalloc(50*sizeof(sys.param[0]));
     sys.entity     = CheckMalloc(50*sizeof(sys.entity[0]));
     sys.constraint = CheckMalloc(50*sizeof(sys.constraint[0]));
@@ -269,6 +528,16 @@ int main()
         sys.params = sys.constraints = sys.entities = 0;
         break;
     }
-    return 0;
+
+    sys.faileds = 50;
+    bad = ExampleFailed();
+    sys.params = sys.constraints = sys.entities = 0;
+
+    bad |= ExampleBatch();
+    sys.params = sys.constraints = sys.entities = 0;
+
+    bad |= ExampleBatchConstrained();
+    sys.params = sys.constraints = sys.entities = 0;
+    return bad;
 }
 
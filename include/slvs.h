@@ -194,6 +194,64 @@ typedef struct {
 
 DLL void Slvs_Solve(Slvs_System *sys, Slvs_hGroup hg);
 
+/* Slvs_Solve works on one sketch inside the library, so it can't be called
+ * from two threads at once. A context holds everything that a solve needs,
+ * so different contexts can be solved at the same time, on different threads;
+ * each context must be used by only one thread at a time. */
+typedef struct Slvs_Context Slvs_Context;
+
+DLL Slvs_Context *Slvs_CreateContext(void);
+DLL void Slvs_SolveInContext(Slvs_Context *ctx, Slvs_System *sys,
+                             Slvs_hGroup hg);
+DLL void Slvs_DestroyContext(Slvs_Context *ctx);
+
+/* A context can also keep a sketch of its own from one solve to the next, so
+ * that it doesn't have to be passed in again each time, and so that solving
+ * it again after changing just the values of the params being solved for
+ * skips straight to the numerical solution. Adding an item with the same
+ * handle as an existing one replaces it. Slvs_SolveContext takes the dragged
+ * params and calculateFaileds from sys, and writes faileds, failed[], dof and
+ * result as Slvs_Solve does; sys->param[], entity[] and constraint[] are
+ * ignored, and the new values of the params stay in the context. A call to
+ * Slvs_SolveInContext discards the context's sketch. */
+DLL void Slvs_AddParam(Slvs_Context *ctx, const Slvs_Param *p);
+DLL void Slvs_AddEntity(Slvs_Context *ctx, const Slvs_Entity *e);
+DLL void Slvs_AddConstraint(Slvs_Context *ctx, const Slvs_Constraint *c);
+DLL void Slvs_RemoveParam(Slvs_Context *ctx, Slvs_hParam h);
+DLL void Slvs_RemoveEntity(Slvs_Context *ctx, Slvs_hEntity h);
+DLL void Slvs_RemoveConstraint(Slvs_Context *ctx, Slvs_hConstraint h);
+DLL void Slvs_SetParamValue(Slvs_Context *ctx, Slvs_hParam h, double val);
+DLL double Slvs_GetParamValue(Slvs_Context *ctx, Slvs_hParam h);
+DLL void Slvs_SetConstraintValue(Slvs_Context *ctx, Slvs_hConstraint h,
+                                 double valA);
+DLL void Slvs_SolveContext(Slvs_Context *ctx, Slvs_System *sys,
+                           Slvs_hGroup hg);
+
+/* To solve the same system many times over, with different initial values
+ * for its params and different values for its dimensions, describe each
+ * scenario like this, and then solve them all at once. */
+typedef struct {
+    /* The values of the params, in the same order as sys->param[]. These
+     * are the initial guesses, and the solution is written back here. */
+    double              *paramVal;
+    /* The values of the dimensions (valA), in the same order as
+     * sys->constraint[], or NULL to use the ones in sys->constraint[]. */
+    double              *valA;
+
+    /* The results, just as in Slvs_System; the caller allocates failed[],
+     * and passes its size in faileds. */
+    Slvs_hConstraint    *failed;
+    int                 faileds;
+    int                 dof;
+    int                 result;
+} Slvs_Scenario;
+
+/* The equations are written once (or once for each thread) for all the
+ * scenarios, which are solved in parallel. The dragged params and
+ * calculateFaileds are taken from sys; nothing in sys is modified. */
+DLL void Slvs_SolveBatch(Slvs_System *sys, Slvs_hGroup hg,
+                         Slvs_Scenario *scenario, int scenarios);
+
 
 /* Our base coordinate system has basis vectors
  *     (1, 0, 0)  (0, 1, 0)  (0, 0, 1)
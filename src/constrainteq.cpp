@@ -28,6 +28,28 @@ bool ConstraintBase::HasLabel() const {
     }
 }
 
+// Whether our equations depend on the values of the params when we wrote
+// them, and not just on the params themselves; e.g., a pivot or a choice
+// between two forms, or a point held where it was. Those can't be reused
+// once the params have moved.
+bool ConstraintBase::HasValuesInEquations() const {
+    switch(type) {
+        case Type::WHERE_DRAGGED:
+        case Type::SAME_ORIENTATION:
+        case Type::ANGLE:
+            return true;
+
+        // These pivot in VectorsParallel, or choose an endpoint, in 3d.
+        case Type::PT_ON_LINE:
+        case Type::PARALLEL:
+        case Type::CUBIC_LINE_TANGENT:
+            return workplane.v == EntityBase::FREE_IN_3D.v;
+
+        default:
+            return false;
+    }
+}
+
 Expr *ConstraintBase::VectorsParallel(int eq, ExprVector a, ExprVector b) {
     ExprVector r = a.Cross(b);
     // Hairy ball theorem screws me here. There's no clean solution that I
@@ -207,7 +229,7 @@ void ConstraintBase::Generate(IdList<Equation,hEquation> *l) const {
     }
 }
 void ConstraintBase::GenerateReal(IdList<Equation,hEquation> *l) const {
-    Expr *exA = Expr::From(valA);
+    Expr *exA = valP.v ? Expr::From(valP) : Expr::From(valA);
 
     switch(type) {
         case Type::PT_PT_DISTANCE:
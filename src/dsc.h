@@ -252,23 +252,66 @@ public:
 };
 
 // A list, where each element has an integer identifier. The list is kept
-// sorted by that identifier, and items can be looked up in log n time by
-// id.
+// sorted by that identifier, and items can be looked up in constant time by
+// id, through a hash table of their positions. Handles are usually assigned
+// in increasing order, so adding an item usually just appends it.
 template <class T, class H>
 class IdList {
 public:
     T     *elem;
     int   n;
     int   elemsAllocated;
+    // An open-addressing hash table, where 0 is an empty slot and i+1 means
+    // elem[i]. It's kept up to date as the list changes, so that any number
+    // of threads can look things up at once; small lists don't have one, and
+    // get searched instead.
+    int   *index;
+    int   indexAllocated;
+
+    enum { MIN_INDEXED = 16 };
+
+    static uint32_t HashId(uint32_t v) {
+        // The handles have a lot of structure, so mix all of their bits.
+        v ^= v >> 16;
+        v *= 0x85ebca6bU;
+        v ^= v >> 13;
+        v *= 0xc2b2ae35U;
+        v ^= v >> 16;
+        return v;
+    }
+
+    void IndexInsert(int i) {
+        uint32_t mask = (uint32_t)indexAllocated - 1;
+        uint32_t s = HashId(elem[i].h.v) & mask;
+        while(index[s] != 0) {
+            s = (s + 1) & mask;
+        }
+        index[s] = i + 1;
+    }
 
-    uint32_t MaximumId() {
-        uint32_t id = 0;
-
-        int i;
-        for(i = 0; i < n; i++) {
-            id = max(id, elem[i].h.v);
+    void RebuildIndex() {
+        if(n < MIN_INDEXED) {
+            if(index) MemFree(index);
+            index = NULL;
+            indexAllocated = 0;
+            return;
+        }
+        // Keep the table at most half full, with room to grow.
+        if(indexAllocated < 2*n) {
+            if(index) MemFree(index);
+            indexAllocated = 1;
+            while(indexAllocated < 4*n) indexAllocated *= 2;
+            index = (int *)MemAlloc((size_t)indexAllocated*sizeof(index[0]));
+        }
+        memset(index, 0, (size_t)indexAllocated*sizeof(index[0]));
+        for(int i = 0; i < n; i++) {
+            IndexInsert(i);
         }
-        return id;
+    }
+
+    uint32_t MaximumId() {
+        // The list is sorted, so that's the last one.
+        return (n == 0) ? 0 : elem[n-1].h.v;
     }
 
     H AddAndAssignId(T *t) {
@@ -278,9 +321,10 @@ public:
         return t->h;
     }
 
-    void Add(T *t) {
-        if(n >= elemsAllocated) {
+    void AllocForMore(int howMuch) {
+        if(n + howMuch > elemsAllocated) {
             elemsAllocated = (elemsAllocated + 32)*2;
+            if(elemsAllocated < n + howMuch) elemsAllocated = n + howMuch;
             T *newElem = (T *)MemAlloc((size_t)elemsAllocated*sizeof(elem[0]));
             for(int i = 0; i < n; i++) {
                 new(&newElem[i]) T(std::move(elem[i]));
@@ -289,8 +333,16 @@ public:
             MemFree(elem);
             elem = newElem;
         }
+    }
+
+    void Add(T *t) {
+        AllocForMore(1);
 
         int first = 0, last = n;
+        if(n > 0 && elem[n-1].h.v < t->h.v) {
+            // The usual case, so don't bother searching.
+            first = last = n;
+        }
         // We know that we must insert within the closed interval [first,last]
         while(first != last) {
             int mid = (first + last)/2;
@@ -308,6 +360,53 @@ public:
         std::move_backward(elem + i, elem + n, elem + n + 1);
         elem[i] = *t;
         n++;
+
+        if(index && indexAllocated >= 2*n) {
+            // Everything after i moved up by one, so fix up their slots; from
+            // the top down, so that no two slots ever hold the same position.
+            uint32_t mask = (uint32_t)indexAllocated - 1;
+            for(int j = n - 1; j > i; j--) {
+                uint32_t s = HashId(elem[j].h.v) & mask;
+                while(index[s] != j) {
+                    s = (s + 1) & mask;
+                }
+                index[s] = j + 1;
+            }
+            IndexInsert(i);
+        } else if(n >= MIN_INDEXED) {
+            // The table is too full, or we didn't have one yet.
+            RebuildIndex();
+        }
+    }
+
+    // Add some items that are already sorted by id. When they don't all go
+    // at the end, that's much faster than adding them one by one.
+    void AddSorted(const T *t, int cnt) {
+        if(cnt == 0) return;
+        AllocForMore(cnt);
+
+        bool atEnd = (n == 0 || elem[n-1].h.v < t[0].h.v);
+        for(int i = 0; i < cnt; i++) {
+            new(&elem[n + i]) T(t[i]);
+        }
+        int oldN = n;
+        n += cnt;
+        if(!atEnd) {
+            std::inplace_merge(elem, elem + oldN, elem + n,
+                [](const T &a, const T &b) { return a.h.v < b.h.v; });
+        }
+        // Also catches a run that wasn't sorted.
+        for(int i = max(atEnd ? oldN : 0, 1); i < n; i++) {
+            ssassert(elem[i-1].h.v < elem[i].h.v, "Handle isn't unique");
+        }
+
+        if(atEnd && index && indexAllocated >= 2*n) {
+            for(int i = oldN; i < n; i++) {
+                IndexInsert(i);
+            }
+        } else {
+            RebuildIndex();
+        }
     }
 
     T *FindById(H h) {
@@ -317,6 +416,15 @@ public:
     }
 
     int IndexOf(H h) {
+        if(index) {
+            uint32_t mask = (uint32_t)indexAllocated - 1;
+            for(uint32_t s = HashId(h.v) & mask; index[s] != 0; s = (s + 1) & mask) {
+                int i = index[s] - 1;
+                if(elem[i].h.v == h.v) return i;
+            }
+            return -1;
+        }
+
         int first = 0, last = n-1;
         while(first <= last) {
             int mid = (first + last)/2;
@@ -333,19 +441,8 @@ public:
     }
 
     T *FindByIdNoOops(H h) {
-        int first = 0, last = n-1;
-        while(first <= last) {
-            int mid = (first + last)/2;
-            H hm = elem[mid].h;
-            if(hm.v > h.v) {
-                last = mid-1; // and first stays the same
-            } else if(hm.v < h.v) {
-                first = mid+1; // and last stays the same
-            } else {
-                return &(elem[mid]);
-            }
-        }
-        return NULL;
+        int i = IndexOf(h);
+        return (i >= 0) ? &(elem[i]) : NULL;
     }
 
     T *First() {
@@ -393,7 +490,10 @@ public:
         }
         for(int i = dest; i < n; i++)
             elem[i].~T();
-        n = dest;
+        if(dest != n) {
+            n = dest;
+            RebuildIndex();
+        }
         // and elemsAllocated is untouched, because we didn't resize
     }
     void RemoveById(H h) {
@@ -407,6 +507,8 @@ public:
         *l = *this;
         elemsAllocated = n = 0;
         elem = NULL;
+        indexAllocated = 0;
+        index = NULL;
     }
 
     void DeepCopyInto(IdList<T,H> *l) {
@@ -416,6 +518,11 @@ public:
             new(&l->elem[i]) T(elem[i]);
         l->elemsAllocated = elemsAllocated;
         l->n = n;
+        if(index) {
+            l->index = (int *)MemAlloc((size_t)indexAllocated*sizeof(index[0]));
+            memcpy(l->index, index, (size_t)indexAllocated*sizeof(index[0]));
+            l->indexAllocated = indexAllocated;
+        }
     }
 
     void Clear() {
@@ -426,6 +533,9 @@ public:
         elemsAllocated = n = 0;
         if(elem) MemFree(elem);
         elem = NULL;
+        indexAllocated = 0;
+        if(index) MemFree(index);
+        index = NULL;
     }
 
 };
@@ -446,6 +556,35 @@ public:
     void Solve();
 };
 
+// A sparse symmetric positive semidefinite matrix, like the A*A' of our
+// least squares solve. We factor it by Gaussian elimination, choosing the
+// pivots in order of minimum degree to keep the fill-in small; rows that
+// turn out to be linearly dependent on the earlier pivots are skipped.
+class SparseSymmetricMatrix {
+public:
+    struct Entry {
+        int     col;
+        double  val;
+    };
+
+    int n;
+    // The nonzero entries of each row, sorted by column. After factoring,
+    // row i holds the row of the triangular factor that pivots on i.
+    std::vector<std::vector<Entry>> row;
+
+    // The pivots in elimination order, and their values.
+    std::vector<int>    order;
+    std::vector<double> pivot;
+    std::vector<bool>   dependent;
+    int                 rank;
+
+    void Clear(int n);
+    void Factor(double tol);
+    void Solve(double *x) const;
+    double InverseQuadraticForm(double *x) const;
+    void NullVector(int p, double *y) const;
+};
+
 #define RGBi(r, g, b) RgbaColor::From((r), (g), (b))
 #define RGBf(r, g, b) RgbaColor::FromFloat((float)(r), (float)(g), (float)(b))
 
@@ -367,6 +367,164 @@ double Expr::Eval() const {
     ssassert(false, "Unexpected operation");
 }
 
+void ExprTape::Clear() {
+    param.clear();
+    paramHandle.clear();
+    paramReg.clear();
+    insn.clear();
+    row.clear();
+    reg.clear();
+    adj.clear();
+    index.clear();
+}
+
+size_t ExprTape::KeyHash::operator()(const Key &k) const {
+    uint64_t h = (uint64_t)k.op;
+    h = h*1000003 + (uint32_t)k.a;
+    h = h*1000003 + (uint32_t)k.b;
+    h = h*1000003 + k.bits;
+    return (size_t)(h ^ (h >> 29));
+}
+
+int ExprTape::AddRow(const Expr *e) {
+    Row rw;
+    rw.regStart   = (int)reg.size();
+    rw.insnStart  = (int)insn.size();
+    rw.paramStart = (int)param.size();
+
+    index.clear();
+    rw.reg = Add(e);
+
+    rw.regEnd     = (int)reg.size();
+    rw.insnEnd    = (int)insn.size();
+    rw.paramEnd   = (int)param.size();
+    row.push_back(rw);
+    adj.resize(reg.size());
+    return (int)row.size() - 1;
+}
+
+int ExprTape::Add(const Expr *e) {
+    Key k = {};
+    k.op = e->op;
+    k.a = k.b = -1;
+    switch(e->op) {
+        case Expr::Op::PARAM_PTR:
+            k.bits = (uint64_t)(uintptr_t)e->parp;
+            break;
+
+        case Expr::Op::CONSTANT:
+            memcpy(&k.bits, &e->v, sizeof(double));
+            break;
+
+        case Expr::Op::PARAM:
+            ssassert(false, "Params must be resolved to pointers first");
+
+        default:
+            k.a = Add(e->a);
+            if(e->Children() > 1) k.b = Add(e->b);
+            break;
+    }
+
+    auto it = index.find(k);
+    if(it != index.end()) return it->second;
+
+    int r = (int)reg.size();
+    if(e->op == Expr::Op::CONSTANT) {
+        reg.push_back(e->v);
+    } else {
+        reg.push_back(0);
+        if(e->op == Expr::Op::PARAM_PTR) {
+            param.push_back(e->parp);
+            paramHandle.push_back(e->parp->h);
+            paramReg.push_back(r);
+        } else {
+            insn.push_back({ e->op, r, k.a, k.b });
+        }
+    }
+    index[k] = r;
+    return r;
+}
+
+void ExprTape::Eval() {
+    double *v = reg.data();
+    for(size_t i = 0; i < param.size(); i++) {
+        v[paramReg[i]] = param[i]->val;
+    }
+    for(const Insn &in : insn) {
+        switch(in.op) {
+            case Expr::Op::PLUS:    v[in.r] = v[in.a] + v[in.b]; break;
+            case Expr::Op::MINUS:   v[in.r] = v[in.a] - v[in.b]; break;
+            case Expr::Op::TIMES:   v[in.r] = v[in.a] * v[in.b]; break;
+            case Expr::Op::DIV:     v[in.r] = v[in.a] / v[in.b]; break;
+
+            case Expr::Op::NEGATE:  v[in.r] = -v[in.a];          break;
+            case Expr::Op::SQRT:    v[in.r] = sqrt(v[in.a]);     break;
+            case Expr::Op::SQUARE:  v[in.r] = v[in.a]*v[in.a];   break;
+            case Expr::Op::SIN:     v[in.r] = sin(v[in.a]);      break;
+            case Expr::Op::COS:     v[in.r] = cos(v[in.a]);      break;
+            case Expr::Op::ACOS:    v[in.r] = acos(v[in.a]);     break;
+            case Expr::Op::ASIN:    v[in.r] = asin(v[in.a]);     break;
+
+            default: ssassert(false, "Unexpected operation");
+        }
+    }
+}
+
+void ExprTape::BindParams(IdList<Param,hParam> *firstTry,
+                          IdList<Param,hParam> *thenTry)
+{
+    for(size_t i = 0; i < param.size(); i++) {
+        Param *p = firstTry->FindByIdNoOops(paramHandle[i]);
+        if(!p) p = thenTry->FindById(paramHandle[i]);
+        param[i] = p;
+    }
+}
+
+void ExprTape::EvalPartials(int r) {
+    const Row &rw = row[r];
+    const double *v = reg.data();
+    double *d = adj.data();
+    std::fill(d + rw.regStart, d + rw.regEnd, 0.0);
+    d[rw.reg] = 1;
+    for(int i = rw.insnEnd - 1; i >= rw.insnStart; i--) {
+        const Insn &in = insn[i];
+        double dr = d[in.r];
+        if(EXACT(dr == 0)) continue;
+        switch(in.op) {
+            case Expr::Op::PLUS:
+                d[in.a] += dr;
+                d[in.b] += dr;
+                break;
+            case Expr::Op::MINUS:
+                d[in.a] += dr;
+                d[in.b] -= dr;
+                break;
+            case Expr::Op::TIMES:
+                d[in.a] += dr*v[in.b];
+                d[in.b] += dr*v[in.a];
+                break;
+            case Expr::Op::DIV:
+                d[in.a] += dr/v[in.b];
+                d[in.b] -= dr*v[in.r]/v[in.b];
+                break;
+
+            case Expr::Op::NEGATE:  d[in.a] -= dr;                          break;
+            case Expr::Op::SQRT:    d[in.a] += dr*0.5/v[in.r];              break;
+            case Expr::Op::SQUARE:  d[in.a] += dr*2*v[in.a];                break;
+            case Expr::Op::SIN:     d[in.a] += dr*cos(v[in.a]);             break;
+            case Expr::Op::COS:     d[in.a] -= dr*sin(v[in.a]);             break;
+            case Expr::Op::ASIN:
+                d[in.a] += dr/sqrt(1 - v[in.a]*v[in.a]);
+                break;
+            case Expr::Op::ACOS:
+                d[in.a] -= dr/sqrt(1 - v[in.a]*v[in.a]);
+                break;
+
+            default: ssassert(false, "Unexpected operation");
+        }
+    }
+}
+
 Expr *Expr::PartialWrt(hParam p) const {
     Expr *da, *db;
 
@@ -426,6 +584,15 @@ uint64_t Expr::ParamsUsed() const {
     return r;
 }
 
+void Expr::ParamsUsedList(std::vector<hParam> *list) const {
+    if(op == Op::PARAM)     list->push_back(parh);
+    if(op == Op::PARAM_PTR) list->push_back(parp->h);
+
+    int c = Children();
+    if(c >= 1)          a->ParamsUsedList(list);
+    if(c >= 2)          b->ParamsUsedList(list);
+}
+
 bool Expr::DependsOn(hParam p) const {
     if(op == Op::PARAM)     return (parh.v    == p.v);
     if(op == Op::PARAM_PTR) return (parp->h.v == p.v);
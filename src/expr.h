@@ -83,6 +83,7 @@ public:
     Expr *PartialWrt(hParam p) const;
     double Eval() const;
     uint64_t ParamsUsed() const;
+    void ParamsUsedList(std::vector<hParam> *list) const;
     bool DependsOn(hParam p) const;
     static bool Tol(double a, double b);
     Expr *FoldConstants();
@@ -127,6 +128,71 @@ public:
     static void Parse();
 };
 
+//-----------------------------------------------------------------------------
+// Expressions compiled to a flat list of instructions, in which each distinct
+// subexpression is computed exactly once, into its own register. The params
+// are read in to their registers all at once, and then the instructions run
+// in order, with no recursion. Each expression is a row of the tape, with
+// its own contiguous instructions and registers, so that the partials of
+// a row with respect to all of its params come from one sweep backwards over
+// those instructions (i.e., reverse mode automatic differentiation).
+//-----------------------------------------------------------------------------
+class ExprTape {
+public:
+    struct Insn {
+        Expr::Op    op;
+        int         r;
+        int         a, b;
+    };
+
+    struct Row {
+        int         reg;
+        int         regStart, regEnd;
+        int         insnStart, insnEnd;
+        int         paramStart, paramEnd;
+    };
+
+    std::vector<Param *>    param;
+    std::vector<hParam>     paramHandle;
+    std::vector<int>        paramReg;
+    std::vector<Insn>       insn;
+    std::vector<Row>        row;
+    std::vector<double>     reg;
+    // The partial derivative of the last row swept backwards, with respect
+    // to each register.
+    std::vector<double>     adj;
+
+    // The register for each subexpression of the row being added, by its
+    // operation, the registers of its operands, and its constant value or
+    // param.
+    struct Key {
+        Expr::Op    op;
+        int         a, b;
+        uint64_t    bits;
+
+        bool operator==(const Key &k) const {
+            return op == k.op && a == k.a && b == k.b && bits == k.bits;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &k) const;
+    };
+    std::unordered_map<Key, int, KeyHash> index;
+
+    void Clear();
+    // Add an expression, whose params must all be pointers, as a new row.
+    int AddRow(const Expr *e);
+    int Add(const Expr *e);
+    // Evaluate every row, and then the partials of one row.
+    void Eval();
+    void EvalPartials(int r);
+
+    // Point the params at a new param table, with the same params as the one
+    // that we compiled against.
+    void BindParams(IdList<Param,hParam> *firstTry,
+                    IdList<Param,hParam> *thenTry);
+};
+
 class ExprVector {
 public:
     Expr *x, *y, *z;
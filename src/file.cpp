@@ -770,6 +770,10 @@ bool SolveSpaceUI::ReloadAllImported(bool canCancel)
     int i;
     for(i = 0; i < SK.group.n; i++) {
         Group *g = &(SK.group.elem[i]);
+        // What we generated for any group may depend on what we generated
+        // for the linked ones, so start again from scratch.
+        g->generated.inputs = 0;
+        g->generated.meshInputs = 0;
         if(g->type != Group::Type::LINKED) continue;
 
         if(isalpha(g->linkFile[0]) && g->linkFile[1] == ':') {
@@ -94,11 +94,8 @@ bool SolveSpaceUI::PruneGroups(hGroup hg) {
 }
 
 bool SolveSpaceUI::PruneRequests(hGroup hg) {
-    int i;
-    for(i = 0; i < SK.entity.n; i++) {
-        Entity *e = &(SK.entity.elem[i]);
-        if(e->group.v != hg.v) continue;
-
+    for(hEntity he : SK.ItemsInGroup(hg).entity) {
+        Entity *e = SK.GetEntity(he);
         if(EntityExists(e->workplane)) continue;
 
         ssassert(e->h.isFromRequest(), "Only explicitly created entities can be pruned");
@@ -111,11 +108,8 @@ bool SolveSpaceUI::PruneRequests(hGroup hg) {
 }
 
 bool SolveSpaceUI::PruneConstraints(hGroup hg) {
-    int i;
-    for(i = 0; i < SK.constraint.n; i++) {
-        Constraint *c = &(SK.constraint.elem[i]);
-        if(c->group.v != hg.v) continue;
-
+    for(hConstraint hc : SK.ItemsInGroup(hg).constraint) {
+        Constraint *c = SK.GetConstraint(hc);
         if(EntityExists(c->workplane) &&
            EntityExists(c->ptA) &&
            EntityExists(c->ptB) &&
@@ -141,8 +135,187 @@ bool SolveSpaceUI::PruneConstraints(hGroup hg) {
     return false;
 }
 
-void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree, bool genForBBox) {
-    int first, last, i, j;
+//-----------------------------------------------------------------------------
+// Hashes, to tell whether anything that goes in to a group changed since we
+// last generated it.
+//-----------------------------------------------------------------------------
+static uint64_t HashString(uint64_t h, const std::string &str) {
+    h = HashMix(h, str.size());
+    for(char c : str) {
+        h = HashMix(h, (uint8_t)c);
+    }
+    return h;
+}
+
+// Everything about the group itself that its entities or its mesh depend on.
+static uint64_t HashGroup(uint64_t h, const Group *g) {
+    h = HashMix(h, g->h.v);
+    h = HashMix(h, (uint32_t)g->type);
+    h = HashMix(h, (uint32_t)g->subtype);
+    h = HashMix(h, g->opA.v);
+    h = HashMix(h, g->opB.v);
+    h = HashMix(h, g->suppress);
+    h = HashMix(h, g->skipFirst);
+    h = HashDouble(h, g->scale);
+    h = HashDouble(h, g->valA);
+    h = HashDouble(h, g->valB);
+    h = HashDouble(h, g->valC);
+    h = HashMix(h, g->color.ToPackedInt());
+    h = HashDouble(h, g->predef.q.w);
+    h = HashDouble(h, g->predef.q.vx);
+    h = HashDouble(h, g->predef.q.vy);
+    h = HashDouble(h, g->predef.q.vz);
+    h = HashMix(h, g->predef.origin.v);
+    h = HashMix(h, g->predef.entityB.v);
+    h = HashMix(h, g->predef.entityC.v);
+    h = HashMix(h, g->predef.swapUV);
+    h = HashMix(h, g->predef.negateU);
+    h = HashMix(h, g->predef.negateV);
+    h = HashMix(h, (uint32_t)g->meshCombine);
+    h = HashMix(h, g->forceToMesh);
+    h = HashString(h, g->linkFile);
+    return h;
+}
+
+static uint64_t HashRequest(uint64_t h, const Request *r) {
+    h = HashMix(h, r->h.v);
+    h = HashMix(h, (uint32_t)r->type);
+    h = HashMix(h, (uint32_t)r->extraPoints);
+    h = HashMix(h, r->workplane.v);
+    h = HashMix(h, r->group.v);
+    h = HashMix(h, r->style.v);
+    h = HashMix(h, r->construction);
+    h = HashString(h, r->str);
+    h = HashString(h, r->font);
+    return h;
+}
+
+// The current values of the params that a group generated.
+static uint64_t HashParamValues(uint64_t h, const Group *g) {
+    for(const Param &p : g->generated.param) {
+        h = HashMix(h, p.h.v);
+        h = HashDouble(h, SK.GetParam(p.h)->val);
+    }
+    return h;
+}
+
+// Copy the items with handles from lo to hi (inclusive) out of a list.
+template<class T, class H>
+static void CopyRange(IdList<T,H> *from, uint32_t lo, uint32_t hi, List<T> *to) {
+    T *t = std::lower_bound(from->begin(), from->end(), lo,
+        [](const T &a, uint32_t v) { return a.h.v < v; });
+    for(; t != from->end() && t->h.v <= hi; t++) {
+        to->Add(t);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Generate the shells and meshes for some groups, given in the order of the
+// sketch. Each group's own shell depends only on the group that it extrudes
+// or copies, so those are built on the thread pool, in as few rounds as that
+// allows; only the running Booleans, each on the one before, go in order.
+//-----------------------------------------------------------------------------
+static void GenerateShellsAndMeshes(const std::vector<Group *> &groups) {
+    for(Group *g : groups) {
+        g->GenerateLoops();
+        g->generated.nakedEdges.Clear();
+    }
+
+    // An extrusion or a lathe needs only the loops of its source group,
+    // which we have, but a step and repeat copies its source's shell; so
+    // that's a round later, if we're generating the source too.
+    std::unordered_map<uint32_t, size_t> round;
+    std::vector<std::vector<Group *>> rounds;
+    for(Group *g : groups) {
+        size_t r = 0;
+        if(g->type == Group::Type::TRANSLATE || g->type == Group::Type::ROTATE) {
+            auto it = round.find(g->opA.v);
+            if(it != round.end()) r = it->second + 1;
+        }
+        round[g->h.v] = r;
+        if(r >= rounds.size()) rounds.resize(r + 1);
+        rounds[r].push_back(g);
+    }
+    for(const std::vector<Group *> &rg : rounds) {
+        ThreadPool::ParallelFor((int)rg.size(), [&](int i) {
+            Group *g = rg[i];
+            SEdgeList *prev = SS.RecordNakedEdgesInto(&g->generated.nakedEdges);
+            g->GenerateThisShellAndMesh();
+            SS.RecordNakedEdgesInto(prev);
+        });
+    }
+
+    for(Group *g : groups) {
+        SEdgeList *prev = SS.RecordNakedEdgesInto(&g->generated.nakedEdges);
+        g->GenerateRunningShellAndMesh();
+        SS.RecordNakedEdgesInto(prev);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Generate the entities for a group, and the params for them. If nothing that
+// went in to that changed since the last time, we just copy what we generated
+// then; that's the common case, since most edits affect only the values of a
+// few params. The requests and constraints also depend on this, so prune them
+// afterwards; returns true if we did.
+//-----------------------------------------------------------------------------
+bool SolveSpaceUI::GenerateGroupEntities(Group *g, uint64_t inputs) {
+    Sketch::GroupItems *items = &SK.groupItems[g->h.v];
+    for(hRequest hr : items->request) {
+        inputs = HashRequest(inputs, SK.GetRequest(hr));
+    }
+    // Zero means that we have nothing cached.
+    if(inputs == 0) inputs = 1;
+
+    if(inputs == g->generated.inputs) {
+        SK.entity.AddSorted(g->generated.entity.elem, g->generated.entity.n);
+        SK.param.AddSorted(g->generated.param.elem, g->generated.param.n);
+    } else {
+        // The requests generate everything from scratch, so they can go to
+        // the sketch all at once.
+        EntityList reqEntity = {};
+        ParamList  reqParam  = {};
+        for(hRequest hr : items->request) {
+            SK.GetRequest(hr)->Generate(&reqEntity, &reqParam);
+        }
+        SK.entity.AddSorted(reqEntity.elem, reqEntity.n);
+        SK.param.AddSorted(reqParam.elem, reqParam.n);
+        // But the group may copy the entities of earlier groups from the list.
+        int entities = SK.entity.n, params = SK.param.n;
+        g->Generate(&(SK.entity), &(SK.param));
+
+        // The requests' handles are all below the group's, so this keeps
+        // them in order.
+        g->generated.entity.Clear();
+        g->generated.param.Clear();
+        for(Entity &e : reqEntity) {
+            g->generated.entity.Add(&e);
+        }
+        for(Param &p : reqParam) {
+            g->generated.param.Add(&p);
+        }
+        CopyRange(&(SK.entity), g->h.entity(0).v, g->h.entity(0xffff).v,
+                  &(g->generated.entity));
+        CopyRange(&(SK.param), g->h.param(0).v, g->h.param(0xffff).v,
+                  &(g->generated.param));
+        ssassert(SK.entity.n - entities + reqEntity.n == g->generated.entity.n &&
+                 SK.param.n - params + reqParam.n == g->generated.param.n,
+                 "Group generated entities outside its own range");
+        g->generated.inputs = inputs;
+
+        reqEntity.Clear();
+        reqParam.Clear();
+    }
+    items->entity.clear();
+    for(Entity &e : g->generated.entity) {
+        items->entity.push_back(e.h);
+    }
+
+    return PruneRequests(g->h) || PruneConstraints(g->h);
+}
+
+void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree) {
+    int first, last, i;
 
     SK.groupOrder.Clear();
     for(int i = 0; i < SK.group.n; i++)
@@ -200,27 +373,25 @@ void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree, bool genForBBox)
         }
     }
 
-    // If we're generating entities for display, first we need to find
-    // the bounding box to turn relative chord tolerance to absolute.
-    if(!SS.exportMode && !genForBBox) {
-        GenerateAll(type, andFindFree, /*genForBBox=*/true);
-        BBox box = SK.CalculateEntityBBox(/*includeInvisibles=*/true);
-        Vector size = box.maxp.Minus(box.minp);
-        double maxSize = std::max({ size.x, size.y, size.z });
-        chordTolCalculated = maxSize * chordTol / 100.0;
-    }
-
     // Remove any requests or constraints that refer to a nonexistent
     // group; can check those immediately, since we know what the list
     // of groups should be.
     while(PruneOrphans())
         ;
+    sys.PruneCompiled();
 
     // Don't lose our numerical guesses when we regenerate.
     IdList<Param,hParam> prev = {};
     SK.param.MoveSelfInto(&prev);
     SK.entity.Clear();
-
+    SK.IndexGroups();
+
+    // Each group's entities depend on its own definition, and on the entities
+    // and solved params of the groups before it; this hashes the latter.
+    uint64_t upstream = 0;
+    Group *pg = NULL;
+    // And the groups whose meshes we'll generate again, once it's solved.
+    std::vector<Group *> meshGroups;
     for(i = 0; i < SK.groupOrder.n; i++) {
         Group *g = SK.GetGroup(SK.groupOrder.elem[i]);
 
@@ -230,23 +401,18 @@ void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree, bool genForBBox)
         if(PruneGroups(g->h))
             goto pruned;
 
-        for(j = 0; j < SK.request.n; j++) {
-            Request *r = &(SK.request.elem[j]);
-            if(r->group.v != g->h.v) continue;
-
-            r->Generate(&(SK.entity), &(SK.param));
+        if(pg) {
+            upstream = HashParamValues(pg->generated.inputs, pg);
         }
-        g->Generate(&(SK.entity), &(SK.param));
-
-        // The requests and constraints depend on stuff in this or the
-        // previous group, so check them after generating.
-        if(PruneRequests(g->h) || PruneConstraints(g->h))
+        if(GenerateGroupEntities(g, HashGroup(upstream, g)))
             goto pruned;
+        pg = g;
 
         // Use the previous values for params that we've seen before, as
-        // initial guesses for the solver.
-        for(j = 0; j < SK.param.n; j++) {
-            Param *newp = &(SK.param.elem[j]);
+        // initial guesses for the solver. The params of earlier groups are
+        // already known, or have those values still.
+        for(Param &p : g->generated.param) {
+            Param *newp = SK.GetParam(p.h);
             if(newp->known) continue;
 
             Param *prevp = prev.FindByIdNoOops(newp->h);
@@ -262,28 +428,71 @@ void SolveSpaceUI::GenerateAll(Generate type, bool andFindFree, bool genForBBox)
             g->clean = true;
         } else {
             if(i >= first && i <= last) {
-                // The group falls inside the range, so really solve it,
-                // and then regenerate the mesh based on the solved stuff.
-                if(genForBBox) {
+                // The group falls inside the range, so really solve it; we
+                // regenerate its mesh below, once everything is solved.
+                if(!SS.exportMode) {
                     SolveGroup(g->h, andFindFree);
-                } else {
-                    g->GenerateLoops();
-                    g->GenerateShellAndMesh();
-                    g->clean = true;
                 }
             } else {
                 // The group falls outside the range, so just assume that
                 // it's good wherever we left it. The mesh is unchanged,
-                // and the parameters must be marked as known.
-                for(j = 0; j < SK.param.n; j++) {
-                    Param *newp = &(SK.param.elem[j]);
+                // and the parameters must be marked as known. Just after
+                // the range, that includes any that we failed to solve;
+                // otherwise, the earlier groups' params are marked already.
+                if(i == last + 1) {
+                    for(Param &p : SK.param) {
+                        if(prev.FindByIdNoOops(p.h)) p.known = true;
+                    }
+                } else {
+                    for(Param &p : g->generated.param) {
+                        if(prev.FindByIdNoOops(p.h)) SK.GetParam(p.h)->known = true;
+                    }
+                }
+            }
+        }
+    }
 
-                    Param *prevp = prev.FindByIdNoOops(newp->h);
-                    if(prevp) newp->known = true;
+    // If we're generating entities for display, we need the bounding box
+    // of everything that we just solved to turn relative chord tolerance
+    // to absolute, and only then can we generate the meshes. The meshes
+    // depend only on the entities of their own and earlier groups, so
+    // those don't need to be generated again.
+    if(!SS.exportMode) {
+        BBox box = SK.CalculateEntityBBox(/*includeInvisibles=*/true);
+        Vector size = box.maxp.Minus(box.minp);
+        double maxSize = std::max({ size.x, size.y, size.z });
+        chordTolCalculated = maxSize * chordTol / 100.0;
+    }
+    // A group's mesh depends on its entities, on its solved params, and on
+    // the meshes of the groups before it, as they were when we generated
+    // them; if none of that changed, the mesh that we have is still good.
+    upstream = HashMix(HashDouble(0, ChordTolMm()), (uint64_t)GetMaxSegments());
+    upstream = HashMix(upstream, checkClosedContour);
+    upstream = HashMix(upstream, exportMode);
+    for(i = 0; i < SK.groupOrder.n; i++) {
+        Group *g = SK.GetGroup(SK.groupOrder.elem[i]);
+        if(g->h.v == Group::HGROUP_REFERENCES.v) continue;
+
+        if(i >= first && i <= last) {
+            uint64_t meshInputs = HashMix(upstream, g->generated.inputs);
+            meshInputs = HashParamValues(meshInputs, g);
+            if(meshInputs == 0) meshInputs = 1;
+
+            if(meshInputs != g->generated.meshInputs) {
+                meshGroups.push_back(g);
+                g->generated.meshInputs = meshInputs;
+            } else if(type == Generate::DIRTY) {
+                // We cleared the naked edges above, but won't find this
+                // group's again; so use the ones from when we did.
+                for(const SEdge &se : g->generated.nakedEdges.l) {
+                    SS.AddNakedEdge(se.a, se.b);
                 }
             }
+            g->clean = true;
         }
+        upstream = HashMix(upstream, g->generated.meshInputs);
     }
+    GenerateShellsAndMeshes(meshGroups);
 
     // And update any reference dimensions with their new values
     for(i = 0; i < SK.constraint.n; i++) {
@@ -356,7 +565,7 @@ pruned:
     SK.param.Clear();
     prev.MoveSelfInto(&(SK.param));
     // Try again
-    GenerateAll(type, andFindFree, genForBBox);
+    GenerateAll(type, andFindFree);
 }
 
 void SolveSpaceUI::ForceReferences() {
@@ -463,11 +672,8 @@ void SolveSpaceUI::SolveGroup(hGroup hg, bool andFindFree) {
     sys.param.Clear();
     sys.eq.Clear();
     // And generate all the params for requests in this group
-    for(i = 0; i < SK.request.n; i++) {
-        Request *r = &(SK.request.elem[i]);
-        if(r->group.v != hg.v) continue;
-
-        r->Generate(&(sys.entity), &(sys.param));
+    for(hRequest hr : SK.ItemsInGroup(hg).request) {
+        SK.GetRequest(hr)->Generate(&(sys.entity), &(sys.param));
     }
     // And for the group itself
     Group *g = SK.GetGroup(hg);
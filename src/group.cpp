@@ -32,6 +32,11 @@ void Group::Clear() {
     impMesh.Clear();
     impShell.Clear();
     impEntity.Clear();
+    generated.entity.Clear();
+    generated.param.Clear();
+    generated.inputs = 0;
+    generated.meshInputs = 0;
+    generated.nakedEdges.Clear();
     // remap is the only one that doesn't get recreated when we regen
     remap.Clear();
 }
@@ -404,9 +409,9 @@ void Group::Generate(IdList<Entity,hEntity> *entity,
             // Get some arbitrary point in the sketch, that will be used
             // as a reference when defining top and bottom faces.
             hEntity pt = { 0 };
-            for(i = 0; i < entity->n; i++) {
-                Entity *e = &(entity->elem[i]);
-                if(e->group.v != opA.v) continue;
+            for(hEntity hop : SK.ItemsInGroup(opA).entity) {
+                Entity *e = entity->FindByIdNoOops(hop);
+                if(!e) continue;
 
                 if(e->IsPoint()) pt = e->h;
 
@@ -441,9 +446,9 @@ void Group::Generate(IdList<Entity,hEntity> *entity,
             // Remapped entity index.
             int ai = 1;
 
-            for(i = 0; i < entity->n; i++) {
-                Entity *e = &(entity->elem[i]);
-                if(e->group.v != opA.v) continue;
+            for(hEntity hop : SK.ItemsInGroup(opA).entity) {
+                Entity *e = entity->FindByIdNoOops(hop);
+                if(!e) continue;
 
                 e->CalculateNumerical(/*forExport=*/false);
                 hEntity he = e->h;
@@ -483,9 +488,9 @@ void Group::Generate(IdList<Entity,hEntity> *entity,
             }
 
             for(a = a0; a < n; a++) {
-                for(i = 0; i < entity->n; i++) {
-                    Entity *e = &(entity->elem[i]);
-                    if(e->group.v != opA.v) continue;
+                for(hEntity hop : SK.ItemsInGroup(opA).entity) {
+                    Entity *e = entity->FindByIdNoOops(hop);
+                    if(!e) continue;
 
                     e->CalculateNumerical(/*forExport=*/false);
                     CopyEntity(entity, e,
@@ -515,9 +520,9 @@ void Group::Generate(IdList<Entity,hEntity> *entity,
             }
 
             for(a = a0; a < n; a++) {
-                for(i = 0; i < entity->n; i++) {
-                    Entity *e = &(entity->elem[i]);
-                    if(e->group.v != opA.v) continue;
+                for(hEntity hop : SK.ItemsInGroup(opA).entity) {
+                    Entity *e = entity->FindByIdNoOops(hop);
+                    if(!e) continue;
 
                     e->CalculateNumerical(/*forExport=*/false);
                     CopyEntity(entity, e,
@@ -16,9 +16,8 @@ void Group::AssembleLoops(bool *allClosed,
     SBezierList sbl = {};
 
     int i;
-    for(i = 0; i < SK.entity.n; i++) {
-        Entity *e = &(SK.entity.elem[i]);
-        if(e->group.v != h.v) continue;
+    for(hEntity he : SK.ItemsInGroup(h).entity) {
+        Entity *e = SK.GetEntity(he);
         if(e->construction) continue;
         if(e->forceHidden) continue;
 
@@ -104,27 +103,48 @@ void SMesh::RemapFaces(Group *g, int remap) {
     }
 }
 
+//-----------------------------------------------------------------------------
+// Union two of the copies in a step and repeat. Copies whose bounding boxes
+// don't touch can't intersect, so those can just be put together.
+//-----------------------------------------------------------------------------
 template<class T>
-void Group::GenerateForStepAndRepeat(T *steps, T *outs) {
-    T workA, workB;
-    workA = {};
-    workB = {};
-    T *soFar = &workA, *scratch = &workB;
+static void UnionCopies(T *a, T *b, T *outs) {
+    if(b->IsEmpty()) {
+        outs->MakeFromCopyOf(a);
+        return;
+    } else if(a->IsEmpty()) {
+        outs->MakeFromCopyOf(b);
+        return;
+    }
+
+    Vector amax, amin, bmax, bmin;
+    a->GetBounding(&amax, &amin);
+    b->GetBounding(&bmax, &bmin);
+    if(Vector::BoundingBoxesDisjoint(amax, amin, bmax, bmin)) {
+        outs->MakeFromAssemblyOf(a, b);
+    } else {
+        outs->MakeFromUnionOf(a, b);
+    }
+}
 
+template<class T>
+void Group::GenerateForStepAndRepeat(T *steps, T *outs) {
     int n = (int)valA, a0 = 0;
     if(subtype == Subtype::ONE_SIDED && skipFirst) {
         a0++; n++;
     }
-    int a;
-    for(a = a0; a < n; a++) {
+
+    // The transformed copies are independent, so make them all at once.
+    std::vector<T> copies(std::max(n - a0, 0));
+    ThreadPool::ParallelFor((int)copies.size(), [&](int i) {
+        int a = a0 + i;
         int ap = a*2 - (subtype == Subtype::ONE_SIDED ? 0 : (n-1));
-        int remap = (a == (n - 1)) ? REMAP_LAST : a;
 
-        T transd = {};
+        T *transd = &copies[i];
         if(type == Type::TRANSLATE) {
             Vector trans = Vector::From(h.param(0), h.param(1), h.param(2));
             trans = trans.ScaledBy(ap);
-            transd.MakeFromTransformationOf(steps,
+            transd->MakeFromTransformationOf(steps,
                 trans, Quaternion::IDENTITY, 1.0);
         } else {
             Vector trans = Vector::From(h.param(0), h.param(1), h.param(2));
@@ -133,27 +153,43 @@ void Group::GenerateForStepAndRepeat(T *steps, T *outs) {
             Vector axis = Vector::From(h.param(4), h.param(5), h.param(6));
             Quaternion q = Quaternion::From(c, s*axis.x, s*axis.y, s*axis.z);
             // Rotation is centered at t; so A(x - t) + t = Ax + (t - At)
-            transd.MakeFromTransformationOf(steps,
+            transd->MakeFromTransformationOf(steps,
                 trans.Minus(q.Rotate(trans)), q, 1.0);
         }
+    });
 
-        // We need to rewrite any plane face entities to the transformed ones.
-        transd.RemapFaces(this, remap);
+    // We need to rewrite any plane face entities to the transformed ones;
+    // in order, since that assigns the new entities' handles.
+    for(int i = 0; i < (int)copies.size(); i++) {
+        int a = a0 + i;
+        int remap = (a == (n - 1)) ? REMAP_LAST : a;
+        copies[i].RemapFaces(this, remap);
+    }
 
-        // And tack this transformed copy on to the return.
-        if(soFar->IsEmpty()) {
-            scratch->MakeFromCopyOf(&transd);
-        } else {
-            scratch->MakeFromUnionOf(soFar, &transd);
+    // And union the copies pairwise, so that each Boolean is between shells
+    // of about the same size, instead of each copy against all the ones
+    // before it. Those may run on other threads, but any naked edges that
+    // they find still belong to this group.
+    SEdgeList *nakedEdges = SS.GetNakedEdgesRecord();
+    while(copies.size() > 1) {
+        std::vector<T> merged((copies.size() + 1) / 2);
+        ThreadPool::ParallelFor((int)(copies.size() / 2), [&](int i) {
+            SEdgeList *prev = SS.RecordNakedEdgesInto(nakedEdges);
+            UnionCopies(&copies[2*i], &copies[2*i + 1], &merged[i]);
+            SS.RecordNakedEdgesInto(prev);
+            copies[2*i].Clear();
+            copies[2*i + 1].Clear();
+        });
+        if(copies.size() % 2 != 0) {
+            merged.back() = copies.back();
         }
-
-        swap(scratch, soFar);
-        scratch->Clear();
-        transd.Clear();
+        swap(copies, merged);
     }
 
     outs->Clear();
-    *outs = *soFar;
+    if(!copies.empty()) {
+        *outs = copies[0];
+    }
 }
 
 template<class T>
@@ -177,16 +213,16 @@ void Group::GenerateForBoolean(T *prevs, T *thiss, T *outs, Group::CombineAs how
     }
 }
 
-void Group::GenerateShellAndMesh() {
-    bool prevBooleanFailed = booleanFailed;
-    booleanFailed = false;
-
+//-----------------------------------------------------------------------------
+// Generate this group's own shell or mesh, before it's combined with the
+// groups before it. That depends only on the group itself and on its source
+// group, so groups can do this at the same time on different threads.
+//-----------------------------------------------------------------------------
+void Group::GenerateThisShellAndMesh() {
     Group *srcg = this;
 
     thisShell.Clear();
     thisMesh.Clear();
-    runningShell.Clear();
-    runningMesh.Clear();
 
     // Don't attempt a lathe or extrusion unless the source section is good:
     // planar and not self-intersecting.
@@ -251,9 +287,8 @@ void Group::GenerateShellAndMesh() {
                 // So these are the sides
                 if(ss->degm != 1 || ss->degn != 1) continue;
 
-                Entity *e;
-                for(e = SK.entity.First(); e; e = SK.entity.NextAfter(e)) {
-                    if(e->group.v != opA.v) continue;
+                for(hEntity he : SK.ItemsInGroup(opA).entity) {
+                    Entity *e = SK.GetEntity(he);
                     if(e->type != Entity::Type::LINE_SEGMENT) continue;
 
                     Vector a = SK.GetEntity(e->point[0])->PointGetNum(),
@@ -308,11 +343,25 @@ void Group::GenerateShellAndMesh() {
     if(srcg->meshCombine != CombineAs::ASSEMBLE) {
         thisShell.MergeCoincidentSurfaces();
     }
+}
 
-    // So now we've got the mesh or shell for this group. Combine it with
-    // the previous group's mesh or shell with the requested Boolean, and
-    // we're done.
+//-----------------------------------------------------------------------------
+// Combine this group's shell or mesh with the previous group's, with the
+// requested Boolean. That must be done in order, after the previous group.
+//-----------------------------------------------------------------------------
+void Group::GenerateRunningShellAndMesh() {
+    bool prevBooleanFailed = booleanFailed;
+    booleanFailed = false;
+
+    runningShell.Clear();
+    runningMesh.Clear();
 
+    // A step and repeat gets merged against the group's prevous group,
+    // not our own previous group.
+    Group *srcg = this;
+    if(type == Type::TRANSLATE || type == Type::ROTATE) {
+        srcg = SK.GetGroup(opA);
+    }
     Group *prevg = srcg->RunningMeshGroup();
 
     if(prevg->runningMesh.IsEmpty() && thisMesh.IsEmpty() && !forceToMesh) {
@@ -5,13 +5,49 @@
 // Copyright 2008-2013 Jonathan Westhues.
 //-----------------------------------------------------------------------------
 #include "solvespace.h"
+#include <atomic>
+#include <mutex>
 #define EXPORT_DLL
 #include <slvs.h>
 
-Sketch SolveSpace::SK = {};
-static System SYS;
+thread_local Sketch *SolveSpace::ActiveSketch = NULL;
+
+// Everything that a solve modifies, so that each context can be solved on
+// its own thread, at the same time as the others.
+struct Slvs_Context {
+    Sketch      sketch;
+    System      sys;
+    TempHeap   *heap;
+
+    // For a session, which keeps its sketch from one solve to the next: the
+    // group of each param, the group that we last solved, whether its
+    // equations depend on the values of its params (so they must always be
+    // written afresh), and whether anything else has changed since.
+    std::unordered_map<Slvs_hParam, Slvs_hGroup> paramGroup;
+    Slvs_hGroup group;
+    bool        valuesInEquations;
+    bool        changed;
+};
+
+// Makes the context's sketch and temporary heap the current ones, for as long
+// as it's in scope.
+class ContextScope {
+public:
+    Sketch      *prevSketch;
+    TempHeap    *prevHeap;
+
+    ContextScope(Slvs_Context *ctx) {
+        prevSketch = ActiveSketch;
+        prevHeap   = SetTemporaryHeap(ctx->heap);
+        ActiveSketch = &(ctx->sketch);
+    }
+    ~ContextScope() {
+        SetTemporaryHeap(prevHeap);
+        ActiveSketch = prevSketch;
+    }
+};
 
-static int IsInit = 0;
+static std::once_flag InitHeapsOnce;
 
 void Group::GenerateEquations(IdList<Equation,hEquation> *) {
     // Nothing to do for now.
@@ -33,112 +69,42 @@ void SolveSpace::DoMessageBox(const char *, int, int, bool)
     abort();
 }
 
-extern "C" {
-
-void Slvs_QuaternionU(double qw, double qx, double qy, double qz,
-                         double *x, double *y, double *z)
-{
-    Quaternion q = Quaternion::From(qw, qx, qy, qz);
-    Vector v = q.RotationU();
-    *x = v.x;
-    *y = v.y;
-    *z = v.z;
-}
-
-void Slvs_QuaternionV(double qw, double qx, double qy, double qz,
-                         double *x, double *y, double *z)
-{
-    Quaternion q = Quaternion::From(qw, qx, qy, qz);
-    Vector v = q.RotationV();
-    *x = v.x;
-    *y = v.y;
-    *z = v.z;
-}
-
-void Slvs_QuaternionN(double qw, double qx, double qy, double qz,
-                         double *x, double *y, double *z)
-{
-    Quaternion q = Quaternion::From(qw, qx, qy, qz);
-    Vector v = q.RotationN();
-    *x = v.x;
-    *y = v.y;
-    *z = v.z;
-}
-
-void Slvs_MakeQuaternion(double ux, double uy, double uz,
-                         double vx, double vy, double vz,
-                         double *qw, double *qx, double *qy, double *qz)
+static bool MakeEntity(const Slvs_Entity *se, EntityBase *e)
 {
-    Vector u = Vector::From(ux, uy, uz),
-           v = Vector::From(vx, vy, vz);
-    Quaternion q = Quaternion::From(u, v);
-    *qw = q.w;
-    *qx = q.vx;
-    *qy = q.vy;
-    *qz = q.vz;
+    switch(se->type) {
+case SLVS_E_POINT_IN_3D:        e->type = Entity::Type::POINT_IN_3D; break;
+case SLVS_E_POINT_IN_2D:        e->type = Entity::Type::POINT_IN_2D; break;
+case SLVS_E_NORMAL_IN_3D:       e->type = Entity::Type::NORMAL_IN_3D; break;
+case SLVS_E_NORMAL_IN_2D:       e->type = Entity::Type::NORMAL_IN_2D; break;
+case SLVS_E_DISTANCE:           e->type = Entity::Type::DISTANCE; break;
+case SLVS_E_WORKPLANE:          e->type = Entity::Type::WORKPLANE; break;
+case SLVS_E_LINE_SEGMENT:       e->type = Entity::Type::LINE_SEGMENT; break;
+case SLVS_E_CUBIC:              e->type = Entity::Type::CUBIC; break;
+case SLVS_E_CIRCLE:             e->type = Entity::Type::CIRCLE; break;
+case SLVS_E_ARC_OF_CIRCLE:      e->type = Entity::Type::ARC_OF_CIRCLE; break;
+
+default: dbp("bad entity type %d", se->type); return false;
+    }
+    e->h.v           = se->h;
+    e->group.v       = se->group;
+    e->workplane.v   = se->wrkpl;
+    e->point[0].v    = se->point[0];
+    e->point[1].v    = se->point[1];
+    e->point[2].v    = se->point[2];
+    e->point[3].v    = se->point[3];
+    e->normal.v      = se->normal;
+    e->distance.v    = se->distance;
+    e->param[0].v    = se->param[0];
+    e->param[1].v    = se->param[1];
+    e->param[2].v    = se->param[2];
+    e->param[3].v    = se->param[3];
+    return true;
 }
 
-void Slvs_Solve(Slvs_System *ssys, Slvs_hGroup shg)
+static bool MakeConstraint(const Slvs_Constraint *sc, ConstraintBase *c)
 {
-    if(!IsInit) {
-        InitHeaps();
-        IsInit = 1;
-    }
-
-    int i;
-    for(i = 0; i < ssys->params; i++) {
-        Slvs_Param *sp = &(ssys->param[i]);
-        Param p = {};
-
-        p.h.v = sp->h;
-        p.val = sp->val;
-        SK.param.Add(&p);
-        if(sp->group == shg) {
-            SYS.param.Add(&p);
-        }
-    }
-
-    for(i = 0; i < ssys->entities; i++) {
-        Slvs_Entity *se = &(ssys->entity[i]);
-        EntityBase e = {};
-
-        switch(se->type) {
-case SLVS_E_POINT_IN_3D:        e.type = Entity::Type::POINT_IN_3D; break;
-case SLVS_E_POINT_IN_2D:        e.type = Entity::Type::POINT_IN_2D; break;
-case SLVS_E_NORMAL_IN_3D:       e.type = Entity::Type::NORMAL_IN_3D; break;
-case SLVS_E_NORMAL_IN_2D:       e.type = Entity::Type::NORMAL_IN_2D; break;
-case SLVS_E_DISTANCE:           e.type = Entity::Type::DISTANCE; break;
-case SLVS_E_WORKPLANE:          e.type = Entity::Type::WORKPLANE; break;
-case SLVS_E_LINE_SEGMENT:       e.type = Entity::Type::LINE_SEGMENT; break;
-case SLVS_E_CUBIC:              e.type = Entity::Type::CUBIC; break;
-case SLVS_E_CIRCLE:             e.type = Entity::Type::CIRCLE; break;
-case SLVS_E_ARC_OF_CIRCLE:      e.type = Entity::Type::ARC_OF_CIRCLE; break;
-
-default: dbp("bad entity type %d", se->type); return;
-        }
-        e.h.v           = se->h;
-        e.group.v       = se->group;
-        e.workplane.v   = se->wrkpl;
-        e.point[0].v    = se->point[0];
-        e.point[1].v    = se->point[1];
-        e.point[2].v    = se->point[2];
-        e.point[3].v    = se->point[3];
-        e.normal.v      = se->normal;
-        e.distance.v    = se->distance;
-        e.param[0].v    = se->param[0];
-        e.param[1].v    = se->param[1];
-        e.param[2].v    = se->param[2];
-        e.param[3].v    = se->param[3];
-
-        SK.entity.Add(&e);
-    }
-
-    for(i = 0; i < ssys->constraints; i++) {
-        Slvs_Constraint *sc = &(ssys->constraint[i]);
-        ConstraintBase c = {};
-
-        Constraint::Type t;
-        switch(sc->type) {
+    Constraint::Type t;
+    switch(sc->type) {
 case SLVS_C_POINTS_COINCIDENT:  t = Constraint::Type::POINTS_COINCIDENT; break;
 case SLVS_C_PT_PT_DISTANCE:     t = Constraint::Type::PT_PT_DISTANCE; break;
 case SLVS_C_PT_PLANE_DISTANCE:  t = Constraint::Type::PT_PLANE_DISTANCE; break;
@@ -174,34 +140,31 @@ case SLVS_C_PROJ_PT_DISTANCE:   t = Constraint::Type::PROJ_PT_DISTANCE; break;
 case SLVS_C_WHERE_DRAGGED:      t = Constraint::Type::WHERE_DRAGGED; break;
 case SLVS_C_CURVE_CURVE_TANGENT:t = Constraint::Type::CURVE_CURVE_TANGENT; break;
 
-default: dbp("bad constraint type %d", sc->type); return;
-        }
-
-        c.type = t;
-
-        c.h.v           = sc->h;
-        c.group.v       = sc->group;
-        c.workplane.v   = sc->wrkpl;
-        c.valA          = sc->valA;
-        c.ptA.v         = sc->ptA;
-        c.ptB.v         = sc->ptB;
-        c.entityA.v     = sc->entityA;
-        c.entityB.v     = sc->entityB;
-        c.entityC.v     = sc->entityC;
-        c.entityD.v     = sc->entityD;
-        c.other         = (sc->other) ? true : false;
-        c.other2        = (sc->other2) ? true : false;
-
-        SK.constraint.Add(&c);
+default: dbp("bad constraint type %d", sc->type); return false;
     }
 
-    for(i = 0; i < (int)arraylen(ssys->dragged); i++) {
-        if(ssys->dragged[i]) {
-            hParam hp = { ssys->dragged[i] };
-            SYS.dragged.Add(&hp);
-        }
-    }
+    c->type = t;
+
+    c->h.v           = sc->h;
+    c->group.v       = sc->group;
+    c->workplane.v   = sc->wrkpl;
+    c->valA          = sc->valA;
+    c->ptA.v         = sc->ptA;
+    c->ptB.v         = sc->ptB;
+    c->entityA.v     = sc->entityA;
+    c->entityB.v     = sc->entityB;
+    c->entityC.v     = sc->entityC;
+    c->entityD.v     = sc->entityD;
+    c->other         = (sc->other) ? true : false;
+    c->other2        = (sc->other2) ? true : false;
+    return true;
+}
 
+// Solve the group, from the sketch (and the params for the system) that are
+// already in place, and report the results to our caller.
+static void SolveGroup(System *sys, Slvs_System *ssys, Slvs_hGroup shg, bool again)
+{
+    int i;
     Group g = {};
     g.h.v = shg;
 
@@ -209,7 +172,12 @@ default: dbp("bad constraint type %d", sc->type); return;
 
     // Now we're finally ready to solve!
     bool andFindBad = ssys->calculateFaileds ? true : false;
-    SolveResult how = SYS.Solve(&g, &(ssys->dof), &bad, andFindBad, /*andFindFree=*/false);
+    SolveResult how;
+    if(again) {
+        how = sys->SolveAgain(&g, &(ssys->dof), &bad, andFindBad, /*andFindFree=*/false);
+    } else {
+        how = sys->Solve(&g, &(ssys->dof), &bad, andFindBad, /*andFindFree=*/false);
+    }
 
     switch(how) {
         case SolveResult::OKAY:
@@ -230,13 +198,6 @@ default: dbp("bad constraint type %d", sc->type); return;
             break;
     }
 
-    // Write the new parameter values back to our caller.
-    for(i = 0; i < ssys->params; i++) {
-        Slvs_Param *sp = &(ssys->param[i]);
-        hParam hp = { sp->h };
-        sp->val = SK.GetParam(hp)->val;
-    }
-
     if(ssys->failed) {
         // Copy over any the list of problematic constraints.
         for(i = 0; i < ssys->faileds && i < bad.n; i++) {
@@ -246,16 +207,385 @@ default: dbp("bad constraint type %d", sc->type); return;
     }
 
     bad.Clear();
-    SYS.param.Clear();
-    SYS.entity.Clear();
-    SYS.eq.Clear();
-    SYS.dragged.Clear();
+}
+
+static void SolveInSketch(System *sys, Slvs_System *ssys, Slvs_hGroup shg)
+{
+    int i;
+    for(i = 0; i < ssys->params; i++) {
+        Slvs_Param *sp = &(ssys->param[i]);
+        Param p = {};
 
+        p.h.v = sp->h;
+        p.val = sp->val;
+        SK.param.Add(&p);
+        if(sp->group == shg) {
+            sys->param.Add(&p);
+        }
+    }
+
+    for(i = 0; i < ssys->entities; i++) {
+        EntityBase e = {};
+        if(!MakeEntity(&(ssys->entity[i]), &e)) return;
+        SK.entity.Add(&e);
+    }
+
+    for(i = 0; i < ssys->constraints; i++) {
+        ConstraintBase c = {};
+        if(!MakeConstraint(&(ssys->constraint[i]), &c)) return;
+        SK.constraint.Add(&c);
+    }
+
+    for(i = 0; i < (int)arraylen(ssys->dragged); i++) {
+        if(ssys->dragged[i]) {
+            hParam hp = { ssys->dragged[i] };
+            sys->dragged.Add(&hp);
+        }
+    }
+
+    SK.IndexGroups();
+    SolveGroup(sys, ssys, shg, /*again=*/false);
+
+    // Write the new parameter values back to our caller.
+    for(i = 0; i < ssys->params; i++) {
+        Slvs_Param *sp = &(ssys->param[i]);
+        hParam hp = { sp->h };
+        sp->val = SK.GetParam(hp)->val;
+    }
+}
+
+extern "C" {
+
+void Slvs_QuaternionU(double qw, double qx, double qy, double qz,
+                         double *x, double *y, double *z)
+{
+    Quaternion q = Quaternion::From(qw, qx, qy, qz);
+    Vector v = q.RotationU();
+    *x = v.x;
+    *y = v.y;
+    *z = v.z;
+}
+
+void Slvs_QuaternionV(double qw, double qx, double qy, double qz,
+                         double *x, double *y, double *z)
+{
+    Quaternion q = Quaternion::From(qw, qx, qy, qz);
+    Vector v = q.RotationV();
+    *x = v.x;
+    *y = v.y;
+    *z = v.z;
+}
+
+void Slvs_QuaternionN(double qw, double qx, double qy, double qz,
+                         double *x, double *y, double *z)
+{
+    Quaternion q = Quaternion::From(qw, qx, qy, qz);
+    Vector v = q.RotationN();
+    *x = v.x;
+    *y = v.y;
+    *z = v.z;
+}
+
+void Slvs_MakeQuaternion(double ux, double uy, double uz,
+                         double vx, double vy, double vz,
+                         double *qw, double *qx, double *qy, double *qz)
+{
+    Vector u = Vector::From(ux, uy, uz),
+           v = Vector::From(vx, vy, vz);
+    Quaternion q = Quaternion::From(u, v);
+    *qw = q.w;
+    *qx = q.vx;
+    *qy = q.vy;
+    *qz = q.vz;
+}
+
+Slvs_Context *Slvs_CreateContext(void)
+{
+    std::call_once(InitHeapsOnce, InitHeaps);
+
+    Slvs_Context *ctx = new Slvs_Context();
+    ctx->heap = CreateTemporaryHeap();
+    return ctx;
+}
+
+void Slvs_DestroyContext(Slvs_Context *ctx)
+{
+    ctx->sys.Clear();
+    ctx->sketch.param.Clear();
+    ctx->sketch.entity.Clear();
+    ctx->sketch.constraint.Clear();
+    ctx->sketch.groupItems.clear();
+    DestroyTemporaryHeap(ctx->heap);
+    delete ctx;
+}
+
+void Slvs_SolveInContext(Slvs_Context *ctx, Slvs_System *ssys, Slvs_hGroup shg)
+{
+    ContextScope scope(ctx);
+
+    // This works on a sketch of its own, so forget any session.
+    ctx->sys.Clear();
+    SK.param.Clear();
+    SK.entity.Clear();
+    SK.constraint.Clear();
+    ctx->paramGroup.clear();
+    ctx->changed = true;
+    FreeTemporaryHeap(ctx->heap);
+
+    SolveInSketch(&(ctx->sys), ssys, shg);
+
+    ctx->sys.Clear();
     SK.param.Clear();
     SK.entity.Clear();
     SK.constraint.Clear();
+    FreeTemporaryHeap(ctx->heap);
+}
+
+void Slvs_Solve(Slvs_System *ssys, Slvs_hGroup shg)
+{
+    static Slvs_Context *DefaultContext = Slvs_CreateContext();
+    Slvs_SolveInContext(DefaultContext, ssys, shg);
+}
+
+void Slvs_AddParam(Slvs_Context *ctx, const Slvs_Param *sp)
+{
+    hParam hp = { sp->h };
+    if(ctx->sketch.param.FindByIdNoOops(hp)) {
+        ctx->sketch.param.RemoveById(hp);
+    }
+    Param p = {};
+    p.h = hp;
+    p.val = sp->val;
+    ctx->sketch.param.Add(&p);
+    ctx->paramGroup[sp->h] = sp->group;
+    ctx->changed = true;
+}
+
+void Slvs_AddEntity(Slvs_Context *ctx, const Slvs_Entity *se)
+{
+    EntityBase e = {};
+    if(!MakeEntity(se, &e)) return;
+    if(ctx->sketch.entity.FindByIdNoOops(e.h)) {
+        ctx->sketch.entity.RemoveById(e.h);
+    }
+    ctx->sketch.entity.Add(&e);
+    ctx->changed = true;
+}
+
+void Slvs_AddConstraint(Slvs_Context *ctx, const Slvs_Constraint *sc)
+{
+    ConstraintBase c = {};
+    if(!MakeConstraint(sc, &c)) return;
+    if(ctx->sketch.constraint.FindByIdNoOops(c.h)) {
+        ctx->sketch.constraint.RemoveById(c.h);
+    }
+    ctx->sketch.constraint.Add(&c);
+    ctx->changed = true;
+}
+
+void Slvs_RemoveParam(Slvs_Context *ctx, Slvs_hParam h)
+{
+    hParam hp = { h };
+    if(!ctx->sketch.param.FindByIdNoOops(hp)) return;
+    ctx->sketch.param.RemoveById(hp);
+    ctx->paramGroup.erase(h);
+    ctx->changed = true;
+}
+
+void Slvs_RemoveEntity(Slvs_Context *ctx, Slvs_hEntity h)
+{
+    hEntity he = { h };
+    if(!ctx->sketch.entity.FindByIdNoOops(he)) return;
+    ctx->sketch.entity.RemoveById(he);
+    ctx->changed = true;
+}
+
+void Slvs_RemoveConstraint(Slvs_Context *ctx, Slvs_hConstraint h)
+{
+    hConstraint hc = { h };
+    if(!ctx->sketch.constraint.FindByIdNoOops(hc)) return;
+    ctx->sketch.constraint.RemoveById(hc);
+    ctx->changed = true;
+}
+
+void Slvs_SetParamValue(Slvs_Context *ctx, Slvs_hParam h, double val)
+{
+    hParam hp = { h };
+    Param *p = ctx->sketch.param.FindByIdNoOops(hp);
+    auto it = ctx->paramGroup.find(h);
+    if(!p || it == ctx->paramGroup.end()) return;
+    p->val = val;
+    // The params of other groups are constants in the equations of the
+    // group that we're solving.
+    if(it->second != ctx->group) ctx->changed = true;
+}
+
+double Slvs_GetParamValue(Slvs_Context *ctx, Slvs_hParam h)
+{
+    hParam hp = { h };
+    Param *p = ctx->sketch.param.FindByIdNoOops(hp);
+    return p ? p->val : 0.0;
+}
+
+void Slvs_SetConstraintValue(Slvs_Context *ctx, Slvs_hConstraint h, double valA)
+{
+    hConstraint hc = { h };
+    ConstraintBase *c = ctx->sketch.constraint.FindByIdNoOops(hc);
+    if(!c) return;
+    c->valA = valA;
+    ctx->changed = true;
+}
+
+static void SolveSession(Slvs_Context *ctx, Slvs_System *ssys, Slvs_hGroup shg)
+{
+    ContextScope scope(ctx);
+    System *sys = &(ctx->sys);
+    int i;
+
+    List<hParam> dragged = {};
+    for(i = 0; i < (int)arraylen(ssys->dragged); i++) {
+        if(ssys->dragged[i]) {
+            hParam hp = { ssys->dragged[i] };
+            dragged.Add(&hp);
+        }
+    }
+
+    Group g = {};
+    g.h.v = shg;
+    bool again = !ctx->changed && !ctx->valuesInEquations &&
+                 shg == ctx->group && sys->CanSolveAgain(&g) &&
+                 dragged.n == sys->dragged.n;
+    for(i = 0; again && i < dragged.n; i++) {
+        if(dragged.elem[i].v != sys->dragged.elem[i].v) again = false;
+    }
+
+    if(!again) {
+        // Write the equations afresh; the old ones can go, since nothing
+        // else refers to them.
+        sys->Clear();
+        FreeTemporaryHeap(ctx->heap);
+        for(Param &p : SK.param) {
+            auto it = ctx->paramGroup.find(p.h.v);
+            if(it == ctx->paramGroup.end() || it->second != shg) continue;
+            Param sp = {};
+            sp.h = p.h;
+            sp.val = p.val;
+            sys->param.Add(&sp);
+        }
+        for(i = 0; i < dragged.n; i++) {
+            sys->dragged.Add(&(dragged.elem[i]));
+        }
+        // Some constraints depend on where things were when we wrote their
+        // equations, so those must be written again each time.
+        ctx->valuesInEquations = false;
+        for(ConstraintBase &c : SK.constraint) {
+            if(c.group.v == shg && c.HasValuesInEquations()) {
+                ctx->valuesInEquations = true;
+            }
+        }
+        SK.IndexGroups();
+        ctx->group = shg;
+        ctx->changed = false;
+    }
+    dragged.Clear();
+
+    SolveGroup(sys, ssys, shg, again);
+}
+
+void Slvs_SolveContext(Slvs_Context *ctx, Slvs_System *ssys, Slvs_hGroup shg)
+{
+    SolveSession(ctx, ssys, shg);
+}
+
+void Slvs_SolveBatch(Slvs_System *ssys, Slvs_hGroup shg,
+                     Slvs_Scenario *scenario, int scenarios)
+{
+    int i;
+
+    // Each dimension is held in a param of its own, in no group, so that
+    // changing it doesn't mean writing the equations again; except for an
+    // angle, whose equation is scaled according to the angle.
+    Slvs_hParam valParam = 0;
+    for(i = 0; i < ssys->params; i++) {
+        valParam = std::max(valParam, ssys->param[i].h);
+    }
+    valParam++;
+    ssassert(ssys->constraints == 0 ||
+             (valParam != 0 &&
+              valParam <= UINT32_MAX - (Slvs_hParam)ssys->constraints),
+             "Ran out of param handles");
+
+    // Each thread solves whichever scenario is next, in a sketch of its own.
+    std::atomic<int> next(0);
+    int threads = std::min(ThreadPool::Concurrency(), scenarios);
+    ThreadPool::ParallelFor(threads, [&](int) {
+        Slvs_Context *ctx = Slvs_CreateContext();
+        int j;
+        for(j = 0; j < ssys->params; j++) {
+            Slvs_AddParam(ctx, &(ssys->param[j]));
+        }
+        for(j = 0; j < ssys->entities; j++) {
+            Slvs_AddEntity(ctx, &(ssys->entity[j]));
+        }
+        for(j = 0; j < ssys->constraints; j++) {
+            Slvs_Constraint *sc = &(ssys->constraint[j]);
+            ConstraintBase c = {};
+            if(!MakeConstraint(sc, &c)) continue;
+            Param p = {};
+            p.h.v = valParam + j;
+            p.val = sc->valA;
+            ctx->sketch.param.Add(&p);
+            c.valP = p.h;
+            ctx->sketch.constraint.Add(&c);
+        }
+
+        // The sketch won't change from here on, so neither will these.
+        std::vector<Param *> paramp, valp;
+        for(j = 0; j < ssys->params; j++) {
+            hParam hp = { ssys->param[j].h };
+            paramp.push_back(ctx->sketch.param.FindById(hp));
+        }
+        for(j = 0; j < ssys->constraints; j++) {
+            hParam hp = { valParam + j };
+            valp.push_back(ctx->sketch.param.FindByIdNoOops(hp));
+        }
+
+        Slvs_System r = {};
+        memcpy(r.dragged, ssys->dragged, sizeof(r.dragged));
+        r.calculateFaileds = ssys->calculateFaileds;
+
+        int k;
+        while((k = next++) < scenarios) {
+            Slvs_Scenario *s = &(scenario[k]);
+            for(j = 0; j < ssys->params; j++) {
+                paramp[j]->val = s->paramVal[j];
+            }
+            for(j = 0; j < ssys->constraints; j++) {
+                if(!valp[j]) continue;
+                Slvs_Constraint *sc = &(ssys->constraint[j]);
+                double v = s->valA ? s->valA[j] : sc->valA;
+                if(sc->group == shg && sc->type == SLVS_C_ANGLE &&
+                   !EXACT(v == valp[j]->val))
+                {
+                    ctx->changed = true;
+                }
+                valp[j]->val = v;
+            }
+
+            r.failed  = s->failed;
+            r.faileds = s->faileds;
+            SolveSession(ctx, &r, shg);
+            s->faileds = r.faileds;
+            s->dof     = r.dof;
+            s->result  = r.result;
+
+            for(j = 0; j < ssys->params; j++) {
+                s->paramVal[j] = paramp[j]->val;
+            }
+        }
 
-    FreeAllTemporary();
+        Slvs_DestroyContext(ctx);
+    });
 }
 
 } /* extern "C" */
@@ -154,34 +154,42 @@ void SEdgeList::AddEdge(Vector a, Vector b, int auxA, int auxB) {
     l.Add(&e);
 }
 
+//-----------------------------------------------------------------------------
+// Follow the edges on from last, until we get back to first. The edges are
+// found through their starting points, or their finishing points too unless
+// keepDir; of the edges that continue the contour, we take the first one in
+// the list.
+//-----------------------------------------------------------------------------
 bool SEdgeList::AssembleContour(Vector first, Vector last, SContour *dest,
-                                SEdge *errorAt, bool keepDir) const
+                                SEdge *errorAt, bool keepDir,
+                                const SPointHash *starts,
+                                const SPointHash *finishes) const
 {
-    int i;
-
     dest->AddPoint(first);
     dest->AddPoint(last);
 
     do {
-        for(i = 0; i < l.n; i++) {
+        int next = -1;
+        bool backwards = false;
+        starts->FindNear(last, [&](int i) {
             SEdge *se = &(l.elem[i]);
-            if(se->tag) continue;
-
+            if(se->tag || (next >= 0 && i >= next)) return;
             if(se->a.Equals(last)) {
-                dest->AddPoint(se->b);
-                last = se->b;
-                se->tag = 1;
-                break;
-            }
-            // Don't allow backwards edges if keepDir is true.
-            if(!keepDir && se->b.Equals(last)) {
-                dest->AddPoint(se->a);
-                last = se->a;
-                se->tag = 1;
-                break;
+                next = i;
             }
+        });
+        // Don't allow backwards edges if keepDir is true.
+        if(!keepDir) {
+            finishes->FindNear(last, [&](int i) {
+                SEdge *se = &(l.elem[i]);
+                if(se->tag || (next >= 0 && i >= next)) return;
+                if(se->b.Equals(last)) {
+                    next = i;
+                    backwards = true;
+                }
+            });
         }
-        if(i >= l.n) {
+        if(next < 0) {
             // Couldn't assemble a closed contour; mark where.
             if(errorAt) {
                 errorAt->a = first;
@@ -190,6 +198,10 @@ bool SEdgeList::AssembleContour(Vector first, Vector last, SContour *dest,
             return false;
         }
 
+        SEdge *se = &(l.elem[next]);
+        last = backwards ? se->a : se->b;
+        dest->AddPoint(last);
+        se->tag = 1;
     } while(!last.Equals(first));
 
     return true;
@@ -198,12 +210,20 @@ bool SEdgeList::AssembleContour(Vector first, Vector last, SContour *dest,
 bool SEdgeList::AssemblePolygon(SPolygon *dest, SEdge *errorAt, bool keepDir) const {
     dest->Clear();
 
+    SPointHash starts = {}, finishes = {};
+    int i;
+    for(i = 0; i < l.n; i++) {
+        starts.Add(l.elem[i].a, i);
+        if(!keepDir) finishes.Add(l.elem[i].b, i);
+    }
+
     bool allClosed = true;
+    // The edges before i are all used already.
+    i = 0;
     for(;;) {
         Vector first = Vector::From(0, 0, 0);
         Vector last  = Vector::From(0, 0, 0);
-        int i;
-        for(i = 0; i < l.n; i++) {
+        for(; i < l.n; i++) {
             if(!l.elem[i].tag) {
                 first = l.elem[i].a;
                 last = l.elem[i].b;
@@ -219,7 +239,7 @@ bool SEdgeList::AssemblePolygon(SPolygon *dest, SEdge *errorAt, bool keepDir) co
         // into that contour.
         dest->AddEmptyContour();
         if(!AssembleContour(first, last, &(dest->l.elem[dest->l.n-1]),
-                errorAt, keepDir))
+                errorAt, keepDir, &starts, &finishes))
         {
             allClosed = false;
         }
@@ -424,7 +444,8 @@ int SKdNodeEdges::AnyEdgeCrossings(Vector a, Vector b, int cnt,
 // We have an edge list that contains only collinear edges, maybe with more
 // splits than necessary. Merge any collinear segments that join.
 //-----------------------------------------------------------------------------
-static Vector LineStart, LineDirection;
+// These are per thread, since meshes are generated on several at once.
+static thread_local Vector LineStart, LineDirection;
 static int ByTAlongLine(const void *av, const void *bv)
 {
     SEdge *a = (SEdge *)av,
@@ -455,8 +476,39 @@ void SEdgeList::MergeCollinearSegments(Vector a, Vector b) {
     l.RemoveTagged();
 }
 
+// Big enough that a point is rarely near enough the edge of its cell that we
+// have to look in the neighbouring cells too.
+const double SPointHash::CELL_SIZE = 64*LENGTH_EPS;
+
+uint64_t SPointHash::Key(int64_t x, int64_t y, int64_t z) {
+    uint64_t h = (uint64_t)x * 0x9e3779b97f4a7c15ULL;
+    h ^= (uint64_t)y * 0xc2b2ae3d27d4eb4fULL + (h << 6) + (h >> 2);
+    h ^= (uint64_t)z * 0x165667b19e3779f9ULL + (h << 6) + (h >> 2);
+    return h;
+}
+
+void SPointHash::Clear() {
+    cell.clear();
+}
+
+void SPointHash::Add(Vector p, int i) {
+    cell.emplace(Key(CellFor(p.x), CellFor(p.y), CellFor(p.z)), i);
+}
+
 void SPointList::Clear() {
     l.Clear();
+    index.Clear();
+    indexed = 0;
+}
+
+void SPointList::UpdateIndex() const {
+    if(indexed > l.n) {
+        index.Clear();
+        indexed = 0;
+    }
+    for(; indexed < l.n; indexed++) {
+        index.Add(l.elem[indexed].p, indexed);
+    }
 }
 
 bool SPointList::ContainsPoint(Vector pt) const {
@@ -464,24 +516,24 @@ bool SPointList::ContainsPoint(Vector pt) const {
 }
 
 int SPointList::IndexForPoint(Vector pt) const {
-    int i;
-    for(i = 0; i < l.n; i++) {
-        SPoint *p = &(l.elem[i]);
-        if(pt.Equals(p->p)) {
-            return i;
+    UpdateIndex();
+    // The first one in the list, if there's more than one.
+    int found = -1;
+    index.FindNear(pt, [&](int i) {
+        if(found >= 0 && i >= found) return;
+        if(pt.Equals(l.elem[i].p)) {
+            found = i;
         }
-    }
-    // Not found, so return negative to indicate that.
-    return -1;
+    });
+    // Or negative, if not found.
+    return found;
 }
 
 void SPointList::IncrementTagFor(Vector pt) {
-    SPoint *p;
-    for(p = l.First(); p; p = l.NextAfter(p)) {
-        if(pt.Equals(p->p)) {
-            (p->tag)++;
-            return;
-        }
+    int i = IndexForPoint(pt);
+    if(i >= 0) {
+        (l.elem[i].tag)++;
+        return;
     }
     SPoint pa;
     pa.p = pt;
@@ -495,6 +547,12 @@ void SPointList::Add(Vector pt) {
     l.Add(&p);
 }
 
+void SPointList::RemoveTagged() {
+    l.RemoveTagged();
+    index.Clear();
+    indexed = 0;
+}
+
 void SContour::AddPoint(Vector p) {
     SPoint sp;
     sp.tag = 0;
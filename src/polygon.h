@@ -35,6 +35,49 @@ enum class EdgeKind : uint32_t {
     SHARP                = 500,
 };
 
+// An index of points by their position, for finding the ones that are
+// Equals() to a given point without searching them all. Each point goes in
+// a cell of a grid, and we look in the neighbouring cells too when the given
+// point is within LENGTH_EPS of the edge of its own cell.
+class SPointHash {
+public:
+    std::unordered_multimap<uint64_t, int>  cell;
+
+    static const double CELL_SIZE;
+
+    static int64_t CellFor(double v) { return (int64_t)floor(v / CELL_SIZE); }
+    static uint64_t Key(int64_t x, int64_t y, int64_t z);
+
+    void Clear();
+    void Add(Vector p, int i);
+
+    // Call fn(i) for each point i that might be Equals() to p; and maybe
+    // for some others, so the caller must check.
+    template<class F>
+    void FindNear(Vector p, F fn) const {
+        int64_t c[3][3];
+        int nc[3];
+        for(int i = 0; i < 3; i++) {
+            double v = p.Element(i);
+            int64_t ci = CellFor(v);
+            nc[i] = 0;
+            c[i][nc[i]++] = ci;
+            if(v - ci*CELL_SIZE < LENGTH_EPS)       c[i][nc[i]++] = ci - 1;
+            if((ci + 1)*CELL_SIZE - v < LENGTH_EPS) c[i][nc[i]++] = ci + 1;
+        }
+        for(int x = 0; x < nc[0]; x++) {
+            for(int y = 0; y < nc[1]; y++) {
+                for(int z = 0; z < nc[2]; z++) {
+                    auto range = cell.equal_range(Key(c[0][x], c[1][y], c[2][z]));
+                    for(auto it = range.first; it != range.second; ++it) {
+                        fn(it->second);
+                    }
+                }
+            }
+        }
+    }
+};
+
 class SEdge {
 public:
     int    tag;
@@ -53,7 +96,9 @@ public:
     void AddEdge(Vector a, Vector b, int auxA=0, int auxB=0);
     bool AssemblePolygon(SPolygon *dest, SEdge *errorAt, bool keepDir=false) const;
     bool AssembleContour(Vector first, Vector last, SContour *dest,
-                            SEdge *errorAt, bool keepDir) const;
+                            SEdge *errorAt, bool keepDir,
+                            const SPointHash *starts,
+                            const SPointHash *finishes) const;
     int AnyEdgeCrossings(Vector a, Vector b,
         Vector *pi=NULL, SPointList *spl=NULL) const;
     bool ContainsEdgeFrom(const SEdgeList *sel) const;
@@ -104,12 +149,19 @@ public:
 class SPointList {
 public:
     List<SPoint>    l;
+    // The first indexed points are in the index. Any that were added to the
+    // list directly get indexed when we next look something up, and if the
+    // list got shorter, then we start over.
+    mutable SPointHash  index;
+    mutable int         indexed;
 
     void Clear();
+    void UpdateIndex() const;
     bool ContainsPoint(Vector pt) const;
     int IndexForPoint(Vector pt) const;
     void IncrementTagFor(Vector pt);
     void Add(Vector pt);
+    void RemoveTagged();
 };
 
 class SContour {
@@ -131,9 +183,7 @@ public:
     void FindPointWithMinX();
     Vector AnyEdgeMidpoint() const;
 
-    bool IsEar(int bp, double scaledEps) const;
     bool BridgeToContour(SContour *sc, SEdgeList *el, List<Vector> *vl);
-    void ClipEarInto(SMesh *m, int bp, double scaledEps);
     void UvTriangulateInto(SMesh *m, SSurface *srf);
 };
 
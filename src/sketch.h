@@ -194,6 +194,18 @@ public:
     SMesh           displayMesh;
     SOutlineList    displayOutlines;
 
+    // Hashes of everything that went in to the entities and the mesh that
+    // we last generated for this group, and a copy of those entities and
+    // their params (and the naked edges that we found in the mesh); if the
+    // hashes come out the same, we can reuse them.
+    struct {
+        uint64_t            inputs;
+        List<Entity>        entity;
+        List<Param>         param;
+        uint64_t            meshInputs;
+        SEdgeList           nakedEdges;
+    } generated;
+
     enum class CombineAs : uint32_t {
         UNION           = 0,
         DIFFERENCE      = 1,
@@ -265,7 +277,8 @@ public:
     Group *RunningMeshGroup();
     bool IsMeshGroup();
 
-    void GenerateShellAndMesh();
+    void GenerateThisShellAndMesh();
+    void GenerateRunningShellAndMesh();
     template<class T> void GenerateForStepAndRepeat(T *steps, T *outs);
     template<class T> void GenerateForBoolean(T *a, T *b, T *o, Group::CombineAs how);
     void GenerateDisplayItems();
@@ -614,6 +627,9 @@ public:
 
     // These are the parameters for the constraint.
     double      valA;
+    // If set, a param whose value is used instead of valA, so that the
+    // value can change without writing the equations again.
+    hParam      valP;
     hEntity     ptA;
     hEntity     ptB;
     hEntity     entityA;
@@ -627,6 +643,7 @@ public:
     std::string comment;    // since comments are represented as constraints
 
     bool HasLabel() const;
+    bool HasValuesInEquations() const;
 
     void Generate(IdList<Equation,hEquation> *l) const;
     void GenerateReal(IdList<Equation,hEquation> *l) const;
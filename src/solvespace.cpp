@@ -234,6 +234,25 @@ void SolveSpaceUI::ScheduleShowTW() {
     later.showTW = true;
 }
 
+// The list that this thread also records naked edges in, if any.
+static thread_local SEdgeList *NakedEdgesRecord = NULL;
+
+void SolveSpaceUI::AddNakedEdge(Vector a, Vector b) {
+    std::lock_guard<std::mutex> lock(nakedEdgesMutex);
+    nakedEdges.AddEdge(a, b);
+    if(NakedEdgesRecord) NakedEdgesRecord->AddEdge(a, b);
+}
+
+SEdgeList *SolveSpaceUI::GetNakedEdgesRecord() {
+    return NakedEdgesRecord;
+}
+
+SEdgeList *SolveSpaceUI::RecordNakedEdgesInto(SEdgeList *el) {
+    SEdgeList *prev = NakedEdgesRecord;
+    NakedEdgesRecord = el;
+    return prev;
+}
+
 void SolveSpaceUI::DoLater() {
     if(later.generateAll) GenerateAll();
     if(later.showTW) TW.Show();
@@ -834,6 +853,7 @@ void Sketch::Clear() {
     style.Clear();
     entity.Clear();
     param.Clear();
+    groupItems.clear();
 }
 
 BBox Sketch::CalculateEntityBBox(bool includingInvisible) {
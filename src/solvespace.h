@@ -27,6 +27,7 @@
 #include <map>
 #include <set>
 #include <chrono>
+#include <mutex>
 
 // We declare these in advance instead of simply using FT_Library
 // (defined as typedef FT_LibraryRec_* FT_Library) because including
@@ -283,6 +284,34 @@ float CnfThawFloat(float val, const std::string &name);
 void *AllocTemporary(size_t n);
 void FreeTemporary(void *p);
 void FreeAllTemporary();
+// Temporaries normally go on one default heap, but a thread can allocate
+// them on its own heap instead, and free that without disturbing anyone else.
+// A NULL heap means the default one.
+struct TempHeap;
+TempHeap *CreateTemporaryHeap();
+void DestroyTemporaryHeap(TempHeap *heap);
+void FreeTemporaryHeap(TempHeap *heap);
+TempHeap *GetTemporaryHeap();
+TempHeap *SetTemporaryHeap(TempHeap *heap); // returns the previous one
+// Everything that this thread allocated on its current heap since a mark
+// can be freed early, by releasing the mark; marks nest like scopes.
+struct TempArena;
+struct TempChunk;
+struct TempMark {
+    TempArena  *arena;
+    TempChunk  *chunk;
+    size_t      used;
+    uint64_t    bigSerial;
+};
+TempMark MarkTemporary();
+void ReleaseTemporary(const TempMark &mark);
+class TemporaryScope {
+public:
+    TempMark mark;
+
+    TemporaryScope() : mark(MarkTemporary()) {}
+    ~TemporaryScope() { ReleaseTemporary(mark); }
+};
 void *MemAlloc(size_t n);
 void MemFree(void *p);
 void InitHeaps();
@@ -296,6 +325,7 @@ void vl(); // debug function to validate heaps
 class Group;
 class SSurface;
 #include "dsc.h"
+#include "threadpool.h"
 #include "polygon.h"
 #include "srf/surface.h"
 #include "render/render.h"
@@ -348,6 +378,8 @@ void MakeMatrix(double *mat, double a11, double a12, double a13, double a14,
                              double a21, double a22, double a23, double a24,
                              double a31, double a32, double a33, double a34,
                              double a41, double a42, double a43, double a44);
+uint64_t HashMix(uint64_t h, uint64_t v);
+uint64_t HashDouble(uint64_t h, double v);
 std::string MakeAcceleratorLabel(int accel);
 bool FilenameHasExtension(const std::string &str, const char *ext);
 void Message(const char *str, ...);
@@ -359,8 +391,6 @@ RgbaColor CnfThawColor(RgbaColor v, const std::string &name);
 
 class System {
 public:
-    enum { MAX_UNKNOWNS = 1024 };
-
     EntityList                      entity;
     ParamList                       param;
     IdList<Equation,hEquation>      eq;
@@ -370,63 +400,134 @@ public:
     List<hParam>                    dragged;
 
     enum {
-        // In general, the tag indicates the subsys that a variable/equation
-        // has been assigned to; these are exceptions for variables:
+        // The tag is zero for the variables and equations that remain to be
+        // solved; these are the exceptions, for variables:
         VAR_SUBSTITUTED      = 10000,
-        VAR_DOF_TEST         = 10001,
         // and for equations:
         EQ_SUBSTITUTED       = 20000
     };
 
+    // Some equations to be solved together for some params, by their
+    // indices in eq and param, sorted.
+    struct Subsystem {
+        std::vector<int>    eq;
+        std::vector<int>    param;
+    };
+
     // The system Jacobian matrix
-    struct {
+    struct Matrix {
         // The corresponding equation for each row
-        hEquation   eq[MAX_UNKNOWNS];
+        std::vector<hEquation>  eq;
 
         // The corresponding parameter for each column
-        hParam      param[MAX_UNKNOWNS];
+        std::vector<hParam>     param;
+
+        // The residuals, compiled with one row per equation. The symbolic
+        // entries below are registers of this tape: for B, the register
+        // that holds the residual, and for A, the register of the param
+        // whose partial it is.
+        ExprTape                tape;
 
         // We're solving AX = B
         int m, n;
         struct {
-            Expr        *sym[MAX_UNKNOWNS][MAX_UNKNOWNS];
-            double       num[MAX_UNKNOWNS][MAX_UNKNOWNS];
+            // Only the nonzero entries are stored, row by row; the entries
+            // of row i are at [row[i], row[i+1]), sorted by column.
+            std::vector<int>        row;
+            std::vector<int>        col;
+            std::vector<int>        sym;
+            std::vector<double>     num;
         }           A;
 
-        double      scale[MAX_UNKNOWNS];
+        std::vector<double>     scale;
 
         // Some helpers for the least squares solve
-        double AAt[MAX_UNKNOWNS][MAX_UNKNOWNS];
-        double Z[MAX_UNKNOWNS];
+        SparseSymmetricMatrix   AAt;
+        std::vector<double>     Z;
 
-        double      X[MAX_UNKNOWNS];
+        std::vector<double>     X;
 
         struct {
-            Expr        *sym[MAX_UNKNOWNS];
-            double       num[MAX_UNKNOWNS];
+            std::vector<int>        sym;
+            std::vector<double>     num;
         }           B;
-    } mat;
+    };
+
+    // What remains after substitution falls into clusters that share no
+    // params, so each can be solved, rank-tested and have its degrees of
+    // freedom counted separately, and on its own thread. Each cluster is
+    // solved as a sequence of blocks, in the order of its block triangular
+    // form.
+    struct Cluster {
+        Subsystem               all;
+        std::vector<Subsystem>  block;
+        std::vector<Matrix>     blockMat;
+        Matrix                  mat;
+        bool                    matWritten;
+        bool                    converged;
+        // The matrix with the residuals of a cluster that didn't converge;
+        // either one of blockMat, or mat.
+        const Matrix           *failedMat;
+        bool                    rankOk;
+    };
+    std::vector<Cluster>            cluster;
+
+    // The substitutions and clusters found for each group, with the
+    // Jacobians of their blocks, kept from one solve to the next. They're
+    // reused for as long as the equations stay the same, apart from the
+    // values of the params that we're solving for (e.g., while dragging).
+    struct Compiled {
+        std::vector<uint64_t>   signature;
+        std::vector<int>        paramTag;
+        std::vector<hParam>     paramSubstd;
+        std::vector<int>        eqTag;
+        std::vector<Cluster>    cluster;
+    };
+    std::unordered_map<uint32_t, Compiled> compiled;
+    void PruneCompiled();
+    // The group whose equations are in eq, still as they were compiled by
+    // the last Solve(), or zero if they've been written afresh since.
+    hGroup                  eqGroup;
 
     static const double RANK_MAG_TOLERANCE, CONVERGE_TOLERANCE;
-    int CalculateRank();
-    bool TestRank();
-    static bool SolveLinearSystem(double X[], double A[][MAX_UNKNOWNS],
-                                  double B[], int N);
-    bool SolveLeastSquares();
+    int CalculateRank(Matrix *mat);
+    bool TestRank(Matrix *mat);
+    void WriteNormalMatrix(Matrix *mat);
+    void FactorLeastSquares(Matrix *mat, double mu);
+    void SolveLeastSquares(Matrix *mat);
 
-    bool WriteJacobian(int tag);
-    void EvalJacobian();
+    void WriteJacobian(int tag, Matrix *mat);
+    void WriteJacobian(const Subsystem &ss, Matrix *mat);
+    void EvalResiduals(Matrix *mat);
+    void EvalJacobian(Matrix *mat);
 
     void WriteEquationsExceptFor(hConstraint hc, Group *g);
+    void WriteSignature(std::vector<uint64_t> *sig);
     void FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad);
+    hParam SubstitutedParam(hParam hp);
     void SolveBySubstitution();
+    void ApplySubstitutions();
+    void FindClusters();
+    void FindBlocks(Cluster *c, const std::vector<std::vector<int>> &eqParams,
+                    const std::vector<std::vector<int>> &paramEqs);
 
     bool IsDragged(hParam p);
 
-    bool NewtonSolve(int tag);
+    bool IsConverged(Matrix *mat);
+    bool NewtonSolve(Matrix *mat);
+    void WriteClusterJacobian(Cluster *c);
+    void SolveCluster(Cluster *c);
+    void FindFreeParams(Cluster *c);
 
     SolveResult Solve(Group *g, int *dof, List<hConstraint> *bad,
                 bool andFindBad, bool andFindFree);
+    SolveResult SolveClusters(Group *g, int *dof, List<hConstraint> *bad,
+                bool andFindBad, bool andFindFree);
+    // Solve the equations of the last Solve() again, when nothing has changed
+    // since but the values (in SK) of the params that we're solving for.
+    bool CanSolveAgain(Group *g);
+    SolveResult SolveAgain(Group *g, int *dof, List<hConstraint> *bad,
+                bool andFindBad, bool andFindFree);
 
     void Clear();
 };
@@ -622,6 +723,16 @@ public:
     IdList<ENTITY,hEntity>          entity;
     IdList<Param,hParam>            param;
 
+    // What's in each group, so that we needn't search the whole sketch for
+    // it. IndexGroups() finds what's there now, and we add the entities for
+    // each group as we generate it.
+    struct GroupItems {
+        std::vector<hRequest>       request;
+        std::vector<hConstraint>    constraint;
+        std::vector<hEntity>        entity;
+    };
+    std::unordered_map<uint32_t, GroupItems> groupItems;
+
     inline CONSTRAINT *GetConstraint(hConstraint h)
         { return constraint.FindById(h); }
     inline ENTITY  *GetEntity (hEntity  h) { return entity. FindById(h); }
@@ -631,6 +742,8 @@ public:
     // Styles are handled a bit differently.
 
     void Clear();
+    void IndexGroups();
+    const GroupItems &ItemsInGroup(hGroup h) const;
 
     BBox CalculateEntityBBox(bool includingInvisible);
     Group *GetRunningMeshGroupFor(hGroup h);
@@ -817,6 +930,13 @@ public:
         hEntity     point;
     } traced;
     SEdgeList nakedEdges;
+    std::mutex nakedEdgesMutex;
+    // Shells are generated on several threads at once, so this locks. The
+    // edge also goes to this thread's record, so that a group can keep the
+    // naked edges from its mesh along with that mesh.
+    void AddNakedEdge(Vector a, Vector b);
+    SEdgeList *GetNakedEdgesRecord();
+    SEdgeList *RecordNakedEdgesInto(SEdgeList *el); // returns the previous one
     struct {
         bool        draw;
         Vector      ptA;
@@ -869,8 +989,8 @@ public:
         UNTIL_ACTIVE,
     };
 
-    void GenerateAll(Generate type = Generate::DIRTY, bool andFindFree = false,
-                     bool genForBBox = false);
+    void GenerateAll(Generate type = Generate::DIRTY, bool andFindFree = false);
+    bool GenerateGroupEntities(Group *g, uint64_t inputs);
     void SolveGroup(hGroup hg, bool andFindFree);
     void MarkDraggedParams();
     void ForceReferences();
@@ -919,7 +1039,15 @@ void ImportDxf(const std::string &file);
 void ImportDwg(const std::string &file);
 
 extern SolveSpaceUI SS;
+#ifdef LIBRARY
+// The library keeps a sketch for each of its contexts, and may be solving
+// many of them at once on different threads; SK is the one that this thread
+// is working on.
+extern thread_local Sketch *ActiveSketch;
+#   define SK (*SolveSpace::ActiveSketch)
+#else
 extern Sketch SK;
+#endif
 
 }
 
@@ -6,7 +6,7 @@
 //-----------------------------------------------------------------------------
 #include "solvespace.h"
 
-static int I;
+static thread_local int I;
 
 void SShell::MakeFromUnionOf(SShell *a, SShell *b) {
     MakeFromBoolean(a, b, SSurface::CombineAs::UNION);
@@ -24,7 +24,8 @@ void SShell::MakeFromDifferenceOf(SShell *a, SShell *b) {
 // the intersection of srfA and srfB.) Return a new pwl curve with everything
 // split.
 //-----------------------------------------------------------------------------
-static Vector LineStart, LineDirection;
+// These are per thread, since shells are generated on several at once.
+static thread_local Vector LineStart, LineDirection;
 static int ByTAlongLine(const void *av, const void *bv)
 {
     SInter *a = (SInter *)av,
@@ -281,10 +282,10 @@ static void DEBUGEDGELIST(SEdgeList *sel, SSurface *surf) {
         arrow = arrow.WithMagnitude(0.01);
         arrow = arrow.Plus(mid);
 
-        SS.nakedEdges.AddEdge(surf->PointAt(se->a.x, se->a.y),
-                              surf->PointAt(se->b.x, se->b.y));
-        SS.nakedEdges.AddEdge(surf->PointAt(mid.x, mid.y),
-                              surf->PointAt(arrow.x, arrow.y));
+        SS.AddNakedEdge(surf->PointAt(se->a.x, se->a.y),
+                        surf->PointAt(se->b.x, se->b.y));
+        SS.AddNakedEdge(surf->PointAt(mid.x, mid.y),
+                        surf->PointAt(arrow.x, arrow.y));
     }
 }
 
@@ -506,7 +507,7 @@ SSurface SSurface::MakeCopyTrimAgainst(SShell *parent,
             sp->tag = 0;
         }
     }
-    choosing.l.RemoveTagged();
+    choosing.RemoveTagged();
 
     // The list of edges to trim our new surface, a combination of edges from
     // our original and intersecting edge lists.
@@ -615,8 +616,21 @@ void SShell::CopySurfacesTrimAgainst(SShell *sha, SShell *shb, SShell *into, SSu
 }
 
 void SShell::MakeIntersectionCurvesAgainst(SShell *agnst, SShell *into) {
+    std::vector<int> near;
     SSurface *sa;
     for(sa = surface.First(); sa; sa = surface.NextAfter(sa)) {
+        if(agnst->bvh) {
+            // Only the surfaces whose bounding boxes overlap can intersect.
+            Vector amax, amin;
+            sa->GetAxisAlignedBounding(&amax, &amin);
+            near.clear();
+            agnst->bvh->SurfacesOverlapping(amax, amin, &near);
+            for(int i : near) {
+                sa->IntersectAgainst(&(agnst->surface.elem[i]), this, agnst, into);
+            }
+            continue;
+        }
+
         SSurface *sb;
         for(sb = agnst->surface.First(); sb; sb = agnst->surface.NextAfter(sb)){
             // Intersect every surface from our shell against every surface
@@ -627,10 +641,141 @@ void SShell::MakeIntersectionCurvesAgainst(SShell *agnst, SShell *into) {
     }
 }
 
+//-----------------------------------------------------------------------------
+// A bounding volume hierarchy over the surfaces of a shell, split at the
+// median along the longest axis of their centers. The boxes are grown by
+// LENGTH_EPS, so that they're conservative for the surfaces' own tests.
+//-----------------------------------------------------------------------------
+static void BuildBvh(SSurfaceBvh *bvh, const std::vector<Vector> &max,
+                     const std::vector<Vector> &min, int first, int count)
+{
+    int n = (int)bvh->node.size();
+    bvh->node.push_back({});
+
+    Vector nmax = Vector::From(VERY_NEGATIVE, VERY_NEGATIVE, VERY_NEGATIVE),
+           nmin = Vector::From(VERY_POSITIVE, VERY_POSITIVE, VERY_POSITIVE),
+           cmax = nmax, cmin = nmin;
+    for(int i = first; i < first + count; i++) {
+        int s = bvh->surface[i];
+        max[s].MakeMaxMin(&nmax, &nmin);
+        min[s].MakeMaxMin(&nmax, &nmin);
+        (max[s].Plus(min[s])).ScaledBy(0.5).MakeMaxMin(&cmax, &cmin);
+    }
+    Vector eps = Vector::From(LENGTH_EPS, LENGTH_EPS, LENGTH_EPS);
+    bvh->node[n].max   = nmax.Plus(eps);
+    bvh->node[n].min   = nmin.Minus(eps);
+    bvh->node[n].first = first;
+    bvh->node[n].count = count;
+    if(count <= 4) return;
+
+    Vector extent = cmax.Minus(cmin);
+    int axis = 0;
+    if(extent.y > extent.Element(axis)) axis = 1;
+    if(extent.z > extent.Element(axis)) axis = 2;
+
+    int half = count / 2;
+    std::vector<int>::iterator begin = bvh->surface.begin() + first;
+    std::nth_element(begin, begin + half, begin + count, [&](int a, int b) {
+        return max[a].Element(axis) + min[a].Element(axis) <
+               max[b].Element(axis) + min[b].Element(axis);
+    });
+
+    bvh->node[n].count = 0;
+    BuildBvh(bvh, max, min, first, half);
+    bvh->node[n].second = (int)bvh->node.size();
+    BuildBvh(bvh, max, min, first + half, count - half);
+}
+
+SSurfaceBvh *SSurfaceBvh::From(SShell *shell) {
+    SSurfaceBvh *bvh = new SSurfaceBvh;
+    int n = shell->surface.n;
+    std::vector<Vector> max(n), min(n);
+    for(int i = 0; i < n; i++) {
+        shell->surface.elem[i].GetAxisAlignedBounding(&max[i], &min[i]);
+        bvh->surface.push_back(i);
+    }
+    if(n > 0) BuildBvh(bvh, max, min, 0, n);
+    return bvh;
+}
+
+// Find the surfaces whose boxes might not be disjoint from the given box,
+// as SSurface::IntersectAgainst tests them.
+void SSurfaceBvh::SurfacesOverlapping(Vector max, Vector min,
+                                      std::vector<int> *l) const
+{
+    if(node.empty()) return;
+    int stack[64], depth = 0;
+    stack[depth++] = 0;
+    while(depth > 0) {
+        const Node *nd = &node[stack[--depth]];
+        if(Vector::BoundingBoxesDisjoint(nd->max, nd->min, max, min)) continue;
+
+        if(nd->count > 0) {
+            l->insert(l->end(), surface.begin() + nd->first,
+                                surface.begin() + nd->first + nd->count);
+        } else {
+            stack[depth++] = nd->second;
+            stack[depth++] = (int)(nd - &node[0]) + 1;
+        }
+    }
+    std::sort(l->begin(), l->end());
+}
+
+// Find the surfaces that the line or segment might intersect, as
+// SSurface::LineEntirelyOutsideBbox tests them.
+void SSurfaceBvh::SurfacesNearLine(Vector a, Vector b, bool asSegment,
+                                   std::vector<int> *l) const
+{
+    if(node.empty()) return;
+    int stack[64], depth = 0;
+    stack[depth++] = 0;
+    while(depth > 0) {
+        const Node *nd = &node[stack[--depth]];
+        if(!Vector::BoundingBoxIntersectsLine(nd->max, nd->min, a, b, asSegment) &&
+           a.OutsideAndNotOn(nd->max, nd->min) && b.OutsideAndNotOn(nd->max, nd->min))
+        {
+            continue;
+        }
+
+        if(nd->count > 0) {
+            l->insert(l->end(), surface.begin() + nd->first,
+                                surface.begin() + nd->first + nd->count);
+        } else {
+            stack[depth++] = nd->second;
+            stack[depth++] = (int)(nd - &node[0]) + 1;
+        }
+    }
+    std::sort(l->begin(), l->end());
+}
+
+void SShell::MakeBvh() {
+    ClearBvh();
+    bvh = SSurfaceBvh::From(this);
+}
+
+void SShell::ClearBvh() {
+    delete bvh;
+    bvh = NULL;
+}
+
+void SShell::ClearClassifyCache() {
+    if(classify) classify->Clear();
+    delete classify;
+    classify = NULL;
+}
+
 void SShell::CleanupAfterBoolean() {
     SSurface *ss;
     for(ss = surface.First(); ss; ss = surface.NextAfter(ss)) {
-        ss->edges.Clear();
+        // The edges against our own curves belong to the cache.
+        bool cached = false;
+        if(classify) {
+            auto it = classify->entry.find(ss->h.v);
+            cached = (it != classify->entry.end() &&
+                      it->second.edges.l.elem == ss->edges.l.elem);
+        }
+        if(!cached) ss->edges.Clear();
+        ss->edges = {};
     }
 }
 
@@ -700,6 +845,10 @@ void SShell::MakeFromAssemblyOf(SShell *a, SShell *b) {
 void SShell::MakeFromBoolean(SShell *a, SShell *b, SSurface::CombineAs type) {
     booleanFailed = false;
 
+    // So that we test only the pairs of surfaces that might intersect.
+    a->MakeBvh();
+    b->MakeBvh();
+
     a->MakeClassifyingBsps(NULL);
     b->MakeClassifyingBsps(NULL);
 
@@ -746,12 +895,19 @@ void SShell::MakeFromBoolean(SShell *a, SShell *b, SSurface::CombineAs type) {
     // And clean up the piecewise linear things we made as a calculation aid
     a->CleanupAfterBoolean();
     b->CleanupAfterBoolean();
+    a->ClearBvh();
+    b->ClearBvh();
 }
 
 //-----------------------------------------------------------------------------
 // All of the BSP routines that we use to perform and accelerate polygon ops.
 //-----------------------------------------------------------------------------
 void SShell::MakeClassifyingBsps(SShell *useCurvesFrom) {
+    if(!useCurvesFrom) {
+        MakeCachedClassifyingBsps();
+        return;
+    }
+
     SSurface *ss;
     for(ss = surface.First(); ss; ss = surface.NextAfter(ss)) {
         ss->MakeClassifyingBsp(this, useCurvesFrom);
@@ -769,6 +925,131 @@ void SSurface::MakeClassifyingBsp(SShell *shell, SShell *useCurvesFrom) {
     MakeEdgesInto(shell, &edges, MakeAs::XYZ, useCurvesFrom);
 }
 
+//-----------------------------------------------------------------------------
+// Against our own curves, the classifying BSPs and edges don't depend on the
+// Boolean, and a shell is often an operand many times over; e.g., the running
+// shell of a group each time that any group after it is regenerated. So keep
+// them, and rebuild only the surfaces whose inputs have changed.
+//-----------------------------------------------------------------------------
+uint64_t SSurface::HashClassifyingInputs(SShell *shell) {
+    uint64_t hash = HashMix(degm, degn);
+    int i, j;
+    for(i = 0; i <= degm; i++) {
+        for(j = 0; j <= degn; j++) {
+            hash = HashDouble(hash, ctrl[i][j].x);
+            hash = HashDouble(hash, ctrl[i][j].y);
+            hash = HashDouble(hash, ctrl[i][j].z);
+            hash = HashDouble(hash, weight[i][j]);
+        }
+    }
+
+    STrimBy *stb;
+    for(stb = trim.First(); stb; stb = trim.NextAfter(stb)) {
+        hash = HashMix(hash, stb->curve.v);
+        hash = HashMix(hash, stb->backwards);
+        hash = HashDouble(hash, stb->start.x);
+        hash = HashDouble(hash, stb->start.y);
+        hash = HashDouble(hash, stb->start.z);
+        hash = HashDouble(hash, stb->finish.x);
+        hash = HashDouble(hash, stb->finish.y);
+        hash = HashDouble(hash, stb->finish.z);
+
+        SCurve *sc = shell->curve.FindById(stb->curve);
+        hash = HashMix(hash, sc->pts.n);
+        SCurvePt *scpt;
+        for(scpt = sc->pts.First(); scpt; scpt = sc->pts.NextAfter(scpt)) {
+            hash = HashDouble(hash, scpt->p.x);
+            hash = HashDouble(hash, scpt->p.y);
+            hash = HashDouble(hash, scpt->p.z);
+        }
+    }
+    return hash;
+}
+
+// Copy a BSP in to nodes of our own, since it was built on the temporary
+// heap and we want it to outlive that.
+static SBspUv *CopyBspInto(const SBspUv *root, std::vector<SBspUv> *nodes) {
+    nodes->clear();
+    if(!root) return NULL;
+
+    // Number the nodes, without recursion since the BSP may be deep.
+    std::vector<const SBspUv *> order;
+    std::unordered_map<const SBspUv *, size_t> index;
+    std::vector<const SBspUv *> stack = { root };
+    while(!stack.empty()) {
+        const SBspUv *n = stack.back();
+        stack.pop_back();
+        index[n] = order.size();
+        order.push_back(n);
+        for(const SBspUv *c : { n->pos, n->neg, n->more }) {
+            if(c) stack.push_back(c);
+        }
+    }
+
+    nodes->resize(order.size());
+    auto link = [&](const SBspUv *n) -> SBspUv * {
+        return n ? &(*nodes)[index[n]] : NULL;
+    };
+    for(size_t i = 0; i < order.size(); i++) {
+        SBspUv *n = &(*nodes)[i];
+        *n = *order[i];
+        n->pos  = link(order[i]->pos);
+        n->neg  = link(order[i]->neg);
+        n->more = link(order[i]->more);
+    }
+    return &(*nodes)[0];
+}
+
+void SShell::MakeCachedClassifyingBsps() {
+    if(!classify) classify = new SClassifyCache {};
+
+    // Forget any surfaces that are gone.
+    auto &entry = classify->entry;
+    for(auto it = entry.begin(); it != entry.end();) {
+        if(surface.FindByIdNoOops(hSSurface { it->first })) {
+            ++it;
+        } else {
+            it->second.edges.Clear();
+            it = entry.erase(it);
+        }
+    }
+
+    SSurface *ss;
+    for(ss = surface.First(); ss; ss = surface.NextAfter(ss)) {
+        uint64_t inputs = ss->HashClassifyingInputs(this);
+
+        auto it = entry.find(ss->h.v);
+        if(it == entry.end() || it->second.inputs != inputs) {
+            SClassifyCache::Entry &e = entry[ss->h.v];
+            e.inputs = inputs;
+
+            SEdgeList el = {};
+            ss->MakeEdgesInto(this, &el, SSurface::MakeAs::UV);
+            {
+                TemporaryScope scope;
+                CopyBspInto(SBspUv::From(&el, ss), &e.bsp);
+            }
+            el.Clear();
+
+            e.edges.Clear();
+            ss->MakeEdgesInto(this, &e.edges, SSurface::MakeAs::XYZ);
+            it = entry.find(ss->h.v);
+        }
+
+        SClassifyCache::Entry &e = it->second;
+        ss->bsp = e.bsp.empty() ? NULL : &e.bsp[0];
+        // Shared with the cache; CleanupAfterBoolean won't free it.
+        ss->edges = e.edges;
+    }
+}
+
+void SClassifyCache::Clear() {
+    for(auto &it : entry) {
+        it.second.edges.Clear();
+    }
+    entry.clear();
+}
+
 SBspUv *SBspUv::Alloc() {
     return (SBspUv *)AllocTemporary(sizeof(SBspUv));
 }
@@ -383,6 +383,16 @@ void SShell::AllPointsIntersecting(Vector a, Vector b,
                                    List<SInter> *il,
                                    bool asSegment, bool trimmed, bool inclTangent)
 {
+    if(bvh) {
+        std::vector<int> near;
+        bvh->SurfacesNearLine(a, b, asSegment, &near);
+        for(int i : near) {
+            surface.elem[i].AllPointsIntersecting(a, b, il,
+                asSegment, trimmed, inclTangent);
+        }
+        return;
+    }
+
     SSurface *ss;
     for(ss = surface.First(); ss; ss = surface.NextAfter(ss)) {
         ss->AllPointsIntersecting(a, b, il,
@@ -603,7 +613,7 @@ bool SShell::ClassifyEdge(Class *indir, Class *outdir,
         if(cnt++ > 5) {
             dbp("can't find a ray that doesn't hit on edge!");
             dbp("on edge = %d, edge_inters = %d", onEdge, edge_inters);
-            SS.nakedEdges.AddEdge(ea, eb);
+            SS.AddNakedEdge(ea, eb);
             break;
         }
     }
@@ -851,9 +851,18 @@ void SShell::MakeSectionEdgesInto(Vector n, double d, SEdgeList *sel, SBezierLis
 }
 
 void SShell::TriangulateInto(SMesh *sm) {
-    SSurface *s;
-    for(s = surface.First(); s; s = surface.NextAfter(s)) {
-        s->TriangulateInto(this, sm);
+    // Each surface reads only its own trim curves, so they're triangulated
+    // at once, each into a mesh of its own; then those go into the output
+    // in the order of the surfaces, whichever threads did the work.
+    std::vector<SMesh> meshes(surface.n);
+    ThreadPool::ParallelFor(surface.n, [&](int i) {
+        surface.elem[i].TriangulateInto(this, &meshes[i]);
+    });
+    for(SMesh &m : meshes) {
+        sm->MakeFromCopyOf(&m);
+        // As if the triangles had been added to it directly.
+        sm->isTransparent = sm->isTransparent || m.isTransparent;
+        m.Clear();
     }
 }
 
@@ -861,6 +870,18 @@ bool SShell::IsEmpty() const {
     return (surface.n == 0);
 }
 
+// The control points of each surface contain it, so this is conservative.
+void SShell::GetBounding(Vector *vmax, Vector *vmin) const {
+    *vmax = Vector::From(VERY_NEGATIVE, VERY_NEGATIVE, VERY_NEGATIVE);
+    *vmin = Vector::From(VERY_POSITIVE, VERY_POSITIVE, VERY_POSITIVE);
+    for(const SSurface &ss : surface) {
+        Vector smax, smin;
+        ss.GetAxisAlignedBounding(&smax, &smin);
+        smax.MakeMaxMin(vmax, vmin);
+        smin.MakeMaxMin(vmax, vmin);
+    }
+}
+
 void SShell::Clear() {
     SSurface *s;
     for(s = surface.First(); s; s = surface.NextAfter(s)) {
@@ -873,5 +894,7 @@ void SShell::Clear() {
         c->Clear();
     }
     curve.Clear();
+    ClearBvh();
+    ClearClassifyCache();
 }
 
@@ -354,6 +354,7 @@ public:
                                 Vector dir);
     void MakeSectionEdgesInto(SShell *shell, SEdgeList *sel, SBezierList *sbl);
     void MakeClassifyingBsp(SShell *shell, SShell *useCurvesFrom);
+    uint64_t HashClassifyingInputs(SShell *shell);
     double ChordToleranceForEdge(Vector a, Vector b) const;
     void MakeTriangulationGridInto(List<double> *l, double vs, double vf,
                                     bool swapped) const;
@@ -363,12 +364,55 @@ public:
     void Clear();
 };
 
+// A bounding volume hierarchy over the surfaces of a shell, so that we can
+// find the surfaces near a line or a box without testing all of them. The
+// surfaces are given by their index in the shell, and reported in order.
+class SSurfaceBvh {
+public:
+    struct Node {
+        Vector  max, min;
+        // A leaf has count > 0 surfaces, starting from first; otherwise the
+        // children are the next node and node second.
+        int     first, count;
+        int     second;
+    };
+    std::vector<Node>   node;
+    std::vector<int>    surface;
+
+    static SSurfaceBvh *From(SShell *shell);
+
+    void SurfacesOverlapping(Vector max, Vector min, std::vector<int> *l) const;
+    void SurfacesNearLine(Vector a, Vector b, bool asSegment,
+                          std::vector<int> *l) const;
+};
+
+// The classifying BSP and xyz edges of each surface against its own shell's
+// curves. Those depend only on the surface, its trims, and the curves that it
+// is trimmed by, so they can be kept from one Boolean to the next; an entry
+// is rebuilt when the hash of those inputs changes.
+class SClassifyCache {
+public:
+    struct Entry {
+        uint64_t                inputs;
+        // The nodes of the BSP, root first, linked to each other.
+        std::vector<SBspUv>     bsp;
+        SEdgeList               edges;
+    };
+    std::unordered_map<uint32_t, Entry> entry;  // by surface handle
+
+    void Clear();
+};
+
 class SShell {
 public:
     IdList<SCurve,hSCurve>      curve;
     IdList<SSurface,hSSurface>  surface;
 
     bool                        booleanFailed;
+    // Only while this shell is an operand of a Boolean.
+    SSurfaceBvh                 *bvh;
+    // Kept for as long as the shell, and reused whenever it's an operand.
+    SClassifyCache              *classify;
 
     void MakeFromExtrusionOf(SBezierLoopSet *sbls, Vector t0, Vector t1,
                              RgbaColor color);
@@ -382,11 +426,15 @@ public:
     void CopySurfacesTrimAgainst(SShell *sha, SShell *shb, SShell *into, SSurface::CombineAs type);
     void MakeIntersectionCurvesAgainst(SShell *against, SShell *into);
     void MakeClassifyingBsps(SShell *useCurvesFrom);
+    void MakeCachedClassifyingBsps();
+    void ClearClassifyCache();
     void AllPointsIntersecting(Vector a, Vector b, List<SInter> *il,
                                 bool asSegment, bool trimmed, bool inclTangent);
     void MakeCoincidentEdgesInto(SSurface *proto, bool sameNormal,
                                  SEdgeList *el, SShell *useCurvesFrom);
     void RewriteSurfaceHandlesForCurves(SShell *a, SShell *b);
+    void MakeBvh();
+    void ClearBvh();
     void CleanupAfterBoolean();
 
     // Definitions when classifying regions of a surface; it is either inside,
@@ -417,6 +465,7 @@ public:
     void MakeEdgesInto(SEdgeList *sel);
     void MakeSectionEdgesInto(Vector n, double d, SEdgeList *sel, SBezierList *sbl);
     bool IsEmpty() const;
+    void GetBounding(Vector *vmax, Vector *vmin) const;
     void RemapFaces(Group *g, int remap);
     void Clear();
 };
@@ -372,7 +372,7 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
                    startv = spl.l.elem[0].auxv;
             spl.l.ClearTags();
             spl.l.elem[0].tag = 1;
-            spl.l.RemoveTagged();
+            spl.RemoveTagged();
 
             // Our chord tolerance is whatever the user specified
             double maxtol = SS.ChordTolMm();
@@ -446,7 +446,7 @@ void SSurface::IntersectAgainst(SSurface *b, SShell *agnstA, SShell *agnstB,
                 start = npc;
             }
 
-            spl.l.RemoveTagged();
+            spl.RemoveTagged();
 
             // And now we split and insert the curve
             SCurve split = sc.MakeCopySplitAgainst(agnstA, agnstB, this, b);
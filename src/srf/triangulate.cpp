@@ -213,14 +213,104 @@ haveEdge:
     return true;
 }
 
-bool SContour::IsEar(int bp, double scaledEps) const {
-    int ap = WRAP(bp-1, l.n),
-        cp = WRAP(bp+1, l.n);
+//-----------------------------------------------------------------------------
+// The state of the ear-clipping: the points that are left form a ring, in
+// their order in the contour, and a grid of all of the points lets us test
+// only the ones near a candidate ear. The ears are kept in order of their
+// chord tolerance, so we can take the best one without searching for it.
+//-----------------------------------------------------------------------------
+class EarClipper {
+public:
+    SContour            *sc;
+    SSurface            *srf;
+    double              scaledEps;
+    bool                isPlane;
+
+    std::vector<int>    prev, next;
+    std::vector<bool>   removed;
+    // The point with the lowest index that's left, and how many there are.
+    int                 first;
+    int                 left;
+
+    std::set<std::pair<double, int>>    ears;
+    std::vector<double>                 earKey;
+
+    Vector              gridMin;
+    double              cellWidth, cellHeight;
+    int                 cols, rows;
+    // The points in cell i are cellPoint[cellStart[i]..cellStart[i+1]).
+    std::vector<int>    cellStart, cellPoint;
+
+    void Init(SContour *c, SSurface *s, double eps);
+    int CellFor(double v, double min, double size, int n) const;
+    bool IsEar(int bp) const;
+    void UpdateEar(int bp);
+    void ClipEarInto(SMesh *m, int bp);
+};
+
+int EarClipper::CellFor(double v, double min, double size, int n) const {
+    int i = (int)floor((v - min) / size);
+    return std::max(0, std::min(n - 1, i));
+}
+
+void EarClipper::Init(SContour *c, SSurface *s, double eps) {
+    sc = c;
+    srf = s;
+    scaledEps = eps;
+    isPlane = (srf->degm == 1 && srf->degn == 1);
+
+    int n = sc->l.n;
+    prev.resize(n);
+    next.resize(n);
+    removed.assign(n, false);
+    earKey.assign(n, 0);
+    for(int i = 0; i < n; i++) {
+        prev[i] = WRAP(i-1, n);
+        next[i] = WRAP(i+1, n);
+    }
+    first = 0;
+    left = n;
+
+    // About one point per cell, on a square grid.
+    Vector maxv = sc->l.elem[0].p, minv = maxv;
+    for(int i = 0; i < n; i++) {
+        (sc->l.elem[i].p).MakeMaxMin(&maxv, &minv);
+    }
+    cols = rows = std::max(1, (int)sqrt((double)n));
+    gridMin = minv;
+    cellWidth  = std::max((maxv.x - minv.x) / cols, LENGTH_EPS);
+    cellHeight = std::max((maxv.y - minv.y) / rows, LENGTH_EPS);
+
+    std::vector<int> cell(n);
+    cellStart.assign(cols*rows + 1, 0);
+    for(int i = 0; i < n; i++) {
+        Vector p = sc->l.elem[i].p;
+        cell[i] = CellFor(p.y, gridMin.y, cellHeight, rows)*cols +
+                  CellFor(p.x, gridMin.x, cellWidth,  cols);
+        cellStart[cell[i] + 1]++;
+    }
+    for(int i = 0; i < cols*rows; i++) {
+        cellStart[i + 1] += cellStart[i];
+    }
+    cellPoint.resize(n);
+    std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    for(int i = 0; i < n; i++) {
+        cellPoint[fill[cell[i]]++] = i;
+    }
+
+    for(int i = 0; i < n; i++) {
+        UpdateEar(i);
+    }
+}
+
+bool EarClipper::IsEar(int bp) const {
+    int ap = prev[bp],
+        cp = next[bp];
 
     STriangle tr = {};
-    tr.a = l.elem[ap].p;
-    tr.b = l.elem[bp].p;
-    tr.c = l.elem[cp].p;
+    tr.a = sc->l.elem[ap].p;
+    tr.b = sc->l.elem[bp].p;
+    tr.c = sc->l.elem[cp].p;
 
     if((tr.a).Equals(tr.c)) {
         // This is two coincident and anti-parallel edges. Zero-area, so
@@ -235,40 +325,73 @@ bool SContour::IsEar(int bp, double scaledEps) const {
         return false;
     }
 
-    // Accelerate with an axis-aligned bounding box test
+    // Accelerate with an axis-aligned bounding box test, on the cells of
+    // the grid that the box covers.
     Vector maxv = tr.a, minv = tr.a;
     (tr.b).MakeMaxMin(&maxv, &minv);
     (tr.c).MakeMaxMin(&maxv, &minv);
 
-    int i;
-    for(i = 0; i < l.n; i++) {
-        if(i == ap || i == bp || i == cp) continue;
-
-        Vector p = l.elem[i].p;
-        if(p.OutsideAndNotOn(maxv, minv)) continue;
-
-        // A point on the edge of the triangle is considered to be inside,
-        // and therefore makes it a non-ear; but a point on the vertex is
-        // "outside", since that's necessary to make bridges work.
-        if(p.EqualsExactly(tr.a)) continue;
-        if(p.EqualsExactly(tr.b)) continue;
-        if(p.EqualsExactly(tr.c)) continue;
-
-        if(tr.ContainsPointProjd(n, p)) {
-            return false;
+    int x0 = CellFor(minv.x - LENGTH_EPS, gridMin.x, cellWidth,  cols),
+        x1 = CellFor(maxv.x + LENGTH_EPS, gridMin.x, cellWidth,  cols),
+        y0 = CellFor(minv.y - LENGTH_EPS, gridMin.y, cellHeight, rows),
+        y1 = CellFor(maxv.y + LENGTH_EPS, gridMin.y, cellHeight, rows);
+    for(int y = y0; y <= y1; y++) {
+        for(int x = x0; x <= x1; x++) {
+            int cell = y*cols + x;
+            for(int j = cellStart[cell]; j < cellStart[cell + 1]; j++) {
+                int i = cellPoint[j];
+                if(removed[i]) continue;
+                if(i == ap || i == bp || i == cp) continue;
+
+                Vector p = sc->l.elem[i].p;
+                if(p.OutsideAndNotOn(maxv, minv)) continue;
+
+                // A point on the edge of the triangle is considered to be
+                // inside, and therefore makes it a non-ear; but a point on
+                // the vertex is "outside", since that's necessary to make
+                // bridges work.
+                if(p.EqualsExactly(tr.a)) continue;
+                if(p.EqualsExactly(tr.b)) continue;
+                if(p.EqualsExactly(tr.c)) continue;
+
+                if(tr.ContainsPointProjd(n, p)) {
+                    return false;
+                }
+            }
         }
     }
     return true;
 }
 
-void SContour::ClipEarInto(SMesh *m, int bp, double scaledEps) {
-    int ap = WRAP(bp-1, l.n),
-        cp = WRAP(bp+1, l.n);
+// Work out whether the point is an ear again, and if so how good an ear.
+void EarClipper::UpdateEar(int bp) {
+    SPoint *pt = &(sc->l.elem[bp]);
+    if(pt->ear == EarType::EAR) {
+        ears.erase({ earKey[bp], bp });
+    }
+    pt->ear = IsEar(bp) ? EarType::EAR : EarType::NOT_EAR;
+    if(pt->ear != EarType::EAR) return;
+
+    if(isPlane) {
+        // This is a plane; any ear is a good ear.
+        earKey[bp] = 0;
+    } else {
+        // If we are triangulating a curved surface, then try to clip ears
+        // that have a small chord tolerance from the surface.
+        earKey[bp] = srf->ChordToleranceForEdge(sc->l.elem[prev[bp]].p,
+                                                sc->l.elem[next[bp]].p);
+    }
+    ears.insert({ earKey[bp], bp });
+}
+
+void EarClipper::ClipEarInto(SMesh *m, int bp) {
+    int ap = prev[bp],
+        cp = next[bp];
 
     STriangle tr = {};
-    tr.a = l.elem[ap].p;
-    tr.b = l.elem[bp].p;
-    tr.c = l.elem[cp].p;
+    tr.a = sc->l.elem[ap].p;
+    tr.b = sc->l.elem[bp].p;
+    tr.c = sc->l.elem[cp].p;
     if(tr.Normal().MagSquared() < scaledEps*scaledEps) {
         // A vertex with more than two edges will cause us to generate
         // zero-area triangles, which must be culled.
@@ -276,14 +399,21 @@ void SContour::ClipEarInto(SMesh *m, int bp, double scaledEps) {
         m->AddTriangle(&tr);
     }
 
+    if(sc->l.elem[bp].ear == EarType::EAR) {
+        ears.erase({ earKey[bp], bp });
+    }
+    removed[bp] = true;
+    next[ap] = cp;
+    prev[cp] = ap;
+    if(bp == first) first = cp;
+    left--;
+
     // By deleting the point at bp, we may change the ear-ness of the points
     // on either side.
-    l.elem[ap].ear = EarType::UNKNOWN;
-    l.elem[cp].ear = EarType::UNKNOWN;
-
-    l.ClearTags();
-    l.elem[bp].tag = 1;
-    l.RemoveTagged();
+    if(left >= 3) {
+        UpdateEar(ap);
+        UpdateEar(cp);
+    }
 }
 
 void SContour::UvTriangulateInto(SMesh *m, SSurface *srf) {
@@ -304,59 +434,37 @@ void SContour::UvTriangulateInto(SMesh *m, SSurface *srf) {
         }
     }
     l.RemoveTagged();
+    if(l.n < 3) return;
 
     // Now calculate the ear-ness of each vertex
     for(i = 0; i < l.n; i++) {
-        (l.elem[i]).ear = IsEar(i, scaledEps) ? EarType::EAR : EarType::NOT_EAR;
+        l.elem[i].ear = EarType::UNKNOWN;
     }
+    EarClipper ec;
+    ec.Init(this, srf, scaledEps);
 
     bool toggle = false;
-    while(l.n > 3) {
-        // Some points may have changed ear-ness, so recalculate
-        for(i = 0; i < l.n; i++) {
-            if(l.elem[i].ear == EarType::UNKNOWN) {
-                (l.elem[i]).ear = IsEar(i, scaledEps) ?
-                                        EarType::EAR : EarType::NOT_EAR;
-            }
+    while(ec.left > 3) {
+        if(ec.ears.empty()) {
+            dbp("couldn't find an ear! fail");
+            return;
         }
 
-        int bestEar = -1;
-        double bestChordTol = VERY_POSITIVE;
-        // Alternate the starting position so we generate strip-like
-        // triangulations instead of fan-like
-        toggle = !toggle;
-        int offset = toggle ? -1 : 0;
-        for(i = 0; i < l.n; i++) {
-            int ear = WRAP(i+offset, l.n);
-            if(l.elem[ear].ear == EarType::EAR) {
-                if(srf->degm == 1 && srf->degn == 1) {
-                    // This is a plane; any ear is a good ear.
-                    bestEar = ear;
-                    break;
-                }
-                // If we are triangulating a curved surface, then try to
-                // clip ears that have a small chord tolerance from the
-                // surface.
-                Vector prev = l.elem[WRAP((i+offset-1), l.n)].p,
-                       next = l.elem[WRAP((i+offset+1), l.n)].p;
-                double tol = srf->ChordToleranceForEdge(prev, next);
-                if(tol < bestChordTol - scaledEps) {
-                    bestEar = ear;
-                    bestChordTol = tol;
-                }
-                if(bestChordTol < 0.1*SS.ChordTolMm()) {
-                    break;
-                }
+        int bestEar = ec.ears.begin()->second;
+        if(ec.isPlane) {
+            // Alternate between the first and the last points, so we
+            // generate strip-like triangulations instead of fan-like; the
+            // best ear is the first already.
+            toggle = !toggle;
+            int last = ec.prev[ec.first];
+            if(toggle && l.elem[last].ear == EarType::EAR) {
+                bestEar = last;
             }
         }
-        if(bestEar < 0) {
-            dbp("couldn't find an ear! fail");
-            return;
-        }
-        ClipEarInto(m, bestEar, scaledEps);
+        ec.ClipEarInto(m, bestEar);
     }
 
-    ClipEarInto(m, 0, scaledEps); // add the last triangle
+    ec.ClipEarInto(m, ec.first); // add the last triangle
 }
 
 double SSurface::ChordToleranceForEdge(Vector a, Vector b) const {
@@ -19,61 +19,343 @@ const double System::RANK_MAG_TOLERANCE = 1e-4;
 // always be much less than LENGTH_EPS, and in practice should be much less.
 const double System::CONVERGE_TOLERANCE = (LENGTH_EPS/(1e2));
 
-bool System::WriteJacobian(int tag) {
-    int a, i, j;
-
-    j = 0;
-    for(a = 0; a < param.n; a++) {
-        if(j >= MAX_UNKNOWNS) return false;
-
-        Param *p = &(param.elem[a]);
-        if(p->tag != tag) continue;
-        mat.param[j] = p->h;
-        j++;
+void System::WriteJacobian(int tag, Matrix *mat) {
+    Subsystem ss;
+    for(int a = 0; a < param.n; a++) {
+        if(param.elem[a].tag == tag) ss.param.push_back(a);
     }
-    mat.n = j;
-
-    i = 0;
-    for(a = 0; a < eq.n; a++) {
-        if(i >= MAX_UNKNOWNS) return false;
+    for(int a = 0; a < eq.n; a++) {
+        if(eq.elem[a].tag == tag) ss.eq.push_back(a);
+    }
+    WriteJacobian(ss, mat);
+}
 
+void System::WriteJacobian(const Subsystem &ss, Matrix *mat) {
+    mat->param.clear();
+    for(int a : ss.param) {
+        mat->param.push_back(param.elem[a].h);
+    }
+    mat->n = (int)mat->param.size();
+
+    mat->eq.clear();
+    mat->tape.Clear();
+    mat->A.row.clear();
+    mat->A.col.clear();
+    mat->A.sym.clear();
+    mat->B.sym.clear();
+    mat->A.row.push_back(0);
+
+    // A typical equation references only a few params, and the partials
+    // with respect to all the others are zero, so we don't store them. The
+    // others all come from the equation's row of the tape, so we just need
+    // to know which register holds the partial for each column.
+    std::vector<std::pair<int, int>> colReg;
+    for(int a : ss.eq) {
         Equation *e = &(eq.elem[a]);
-        if(e->tag != tag) continue;
 
-        mat.eq[i] = e->h;
+        mat->eq.push_back(e->h);
         Expr *f = e->e->DeepCopyWithParamsAsPointers(&param, &(SK.param));
         f = f->FoldConstants();
 
-        // Hash table (61 bits) to accelerate generation of zero partials.
-        uint64_t scoreboard = f->ParamsUsed();
-        for(j = 0; j < mat.n; j++) {
-            Expr *pd;
-            if(scoreboard & ((uint64_t)1 << (mat.param[j].v % 61)) &&
-                f->DependsOn(mat.param[j]))
-            {
-                pd = f->PartialWrt(mat.param[j]);
-                pd = pd->FoldConstants();
-                pd = pd->DeepCopyWithParamsAsPointers(&param, &(SK.param));
-            } else {
-                pd = Expr::From(0.0);
-            }
-            mat.A.sym[i][j] = pd;
+        const ExprTape::Row &rw = mat->tape.row[mat->tape.AddRow(f)];
+        colReg.clear();
+        for(int k = rw.paramStart; k < rw.paramEnd; k++) {
+            int i = param.IndexOf(mat->tape.param[k]->h);
+            if(i < 0) continue;
+            auto it = std::lower_bound(ss.param.begin(), ss.param.end(), i);
+            if(it == ss.param.end() || *it != i) continue;
+            colReg.push_back({ (int)(it - ss.param.begin()), mat->tape.paramReg[k] });
+        }
+        std::sort(colReg.begin(), colReg.end());
+        for(const auto &cr : colReg) {
+            mat->A.col.push_back(cr.first);
+            mat->A.sym.push_back(cr.second);
         }
-        mat.B.sym[i] = f;
-        i++;
+        mat->A.row.push_back((int)mat->A.col.size());
+        mat->B.sym.push_back(rw.reg);
     }
-    mat.m = i;
+    mat->m = (int)mat->eq.size();
 
-    return true;
+    mat->A.num.resize(mat->A.sym.size());
+    mat->B.num.resize(mat->m);
+}
+
+void System::EvalResiduals(Matrix *mat) {
+    mat->tape.Eval();
+    for(int i = 0; i < mat->m; i++) {
+        mat->B.num[i] = mat->tape.reg[mat->B.sym[i]];
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Evaluate the Jacobian, and the residuals too, since the partials come from
+// the same evaluation of the tape.
+//-----------------------------------------------------------------------------
+void System::EvalJacobian(Matrix *mat) {
+    EvalResiduals(mat);
+    for(int i = 0; i < mat->m; i++) {
+        mat->tape.EvalPartials(i);
+        for(int k = mat->A.row[i]; k < mat->A.row[i + 1]; k++) {
+            mat->A.num[k] = mat->tape.adj[mat->A.sym[k]];
+        }
+    }
 }
 
-void System::EvalJacobian() {
+//-----------------------------------------------------------------------------
+// Break the equations and params that remain after substitution into
+// clusters, by finding the connected components of the graph in which each
+// equation is joined to the params that it references.
+//-----------------------------------------------------------------------------
+void System::FindClusters() {
     int i, j;
-    for(i = 0; i < mat.m; i++) {
-        for(j = 0; j < mat.n; j++) {
-            mat.A.num[i][j] = (mat.A.sym[i][j])->Eval();
+
+    std::vector<std::vector<int>> eqParams(eq.n), paramEqs(param.n);
+    std::vector<hParam> paramsUsed;
+    for(i = 0; i < eq.n; i++) {
+        Equation *e = &(eq.elem[i]);
+        if(e->tag != 0) continue;
+
+        paramsUsed.clear();
+        e->e->ParamsUsedList(&paramsUsed);
+        for(hParam hp : paramsUsed) {
+            j = param.IndexOf(hp);
+            if(j < 0 || param.elem[j].tag != 0) continue;
+            eqParams[i].push_back(j);
+        }
+        std::sort(eqParams[i].begin(), eqParams[i].end());
+        eqParams[i].erase(std::unique(eqParams[i].begin(), eqParams[i].end()),
+                          eqParams[i].end());
+        for(int p : eqParams[i]) {
+            paramEqs[p].push_back(i);
         }
     }
+
+    cluster.clear();
+    std::vector<bool> eqSeen(eq.n, false), paramSeen(param.n, false);
+    std::vector<int> stack;
+    for(i = 0; i < eq.n; i++) {
+        if(eq.elem[i].tag != 0 || eqSeen[i]) continue;
+
+        cluster.emplace_back();
+        Subsystem *ss = &(cluster.back().all);
+        eqSeen[i] = true;
+        stack.push_back(i);
+        while(!stack.empty()) {
+            int e = stack.back();
+            stack.pop_back();
+            ss->eq.push_back(e);
+            for(int p : eqParams[e]) {
+                if(paramSeen[p]) continue;
+                paramSeen[p] = true;
+                ss->param.push_back(p);
+                for(int ep : paramEqs[p]) {
+                    if(eqSeen[ep]) continue;
+                    eqSeen[ep] = true;
+                    stack.push_back(ep);
+                }
+            }
+        }
+        std::sort(ss->eq.begin(), ss->eq.end());
+        std::sort(ss->param.begin(), ss->param.end());
+
+        FindBlocks(&(cluster.back()), eqParams, paramEqs);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Break a cluster into blocks that can be solved one after another, using the
+// Dulmage-Mendelsohn decomposition. Starting from a maximum matching between
+// equations and params, the overconstrained part is everything reachable by
+// alternating paths from an unmatched equation, and the underconstrained
+// part everything reachable from an unmatched param. The rest is square, and
+// splits further into the strongly connected components of the graph in
+// which each equation points to the equations matched to its params. The
+// overconstrained part goes first, because its equations reference no other
+// params; then the square blocks, each after all the blocks it depends on;
+// and the underconstrained part last, since it may reference anything.
+//-----------------------------------------------------------------------------
+void System::FindBlocks(Cluster *c, const std::vector<std::vector<int>> &eqParams,
+                        const std::vector<std::vector<int>> &paramEqs)
+{
+    const Subsystem &all = c->all;
+    int m = (int)all.eq.size(), n = (int)all.param.size();
+    int r, k;
+
+    c->block.clear();
+    if(m == 1 || n <= 1) {
+        // Nothing to break up.
+        c->block.push_back(all);
+        return;
+    }
+
+    // Work with indices local to the cluster.
+    auto eqLocal = [&](int e) {
+        return (int)(std::lower_bound(all.eq.begin(), all.eq.end(), e) - all.eq.begin());
+    };
+    auto paramLocal = [&](int p) {
+        return (int)(std::lower_bound(all.param.begin(), all.param.end(), p) - all.param.begin());
+    };
+    std::vector<std::vector<int>> adj(m);
+    for(r = 0; r < m; r++) {
+        for(int p : eqParams[all.eq[r]]) {
+            adj[r].push_back(paramLocal(p));
+        }
+    }
+
+    // Find a maximum matching; greedily first, then by augmenting paths.
+    std::vector<int> rowMatch(m, -1), colMatch(n, -1);
+    for(r = 0; r < m; r++) {
+        for(int col : adj[r]) {
+            if(colMatch[col] < 0) {
+                rowMatch[r] = col;
+                colMatch[col] = r;
+                break;
+            }
+        }
+    }
+    std::vector<int> colSeen(n, -1), pathCol;
+    std::vector<std::pair<int, size_t>> path;
+    for(r = 0; r < m; r++) {
+        if(rowMatch[r] >= 0) continue;
+
+        path.clear();
+        pathCol.clear();
+        path.push_back({ r, 0 });
+        pathCol.push_back(-1);
+        while(!path.empty()) {
+            int row = path.back().first;
+            if(path.back().second >= adj[row].size()) {
+                path.pop_back();
+                pathCol.pop_back();
+                continue;
+            }
+            int col = adj[row][path.back().second++];
+            if(colSeen[col] == r) continue;
+            colSeen[col] = r;
+            pathCol.back() = col;
+            if(colMatch[col] < 0) {
+                // Found an augmenting path, so flip it.
+                for(k = 0; k < (int)path.size(); k++) {
+                    rowMatch[path[k].first] = pathCol[k];
+                    colMatch[pathCol[k]] = path[k].first;
+                }
+                break;
+            }
+            path.push_back({ colMatch[col], 0 });
+            pathCol.push_back(-1);
+        }
+    }
+
+    // Now the overconstrained and underconstrained parts.
+    std::vector<bool> rowOver(m, false), colOver(n, false);
+    std::vector<bool> rowUnder(m, false), colUnder(n, false);
+    std::vector<int> stack;
+    for(r = 0; r < m; r++) {
+        if(rowMatch[r] >= 0) continue;
+        rowOver[r] = true;
+        stack.push_back(r);
+    }
+    while(!stack.empty()) {
+        int row = stack.back();
+        stack.pop_back();
+        for(int col : adj[row]) {
+            if(colOver[col]) continue;
+            colOver[col] = true;
+            int next = colMatch[col];
+            if(next >= 0 && !rowOver[next]) {
+                rowOver[next] = true;
+                stack.push_back(next);
+            }
+        }
+    }
+    for(int col = 0; col < n; col++) {
+        if(colMatch[col] >= 0) continue;
+        colUnder[col] = true;
+        stack.push_back(col);
+    }
+    while(!stack.empty()) {
+        int col = stack.back();
+        stack.pop_back();
+        for(int e : paramEqs[all.param[col]]) {
+            int row = eqLocal(e);
+            if(rowUnder[row]) continue;
+            rowUnder[row] = true;
+            int next = rowMatch[row];
+            if(next >= 0 && !colUnder[next]) {
+                colUnder[next] = true;
+                stack.push_back(next);
+            }
+        }
+    }
+
+    Subsystem over, under;
+    for(r = 0; r < m; r++) {
+        if(rowOver[r])  over.eq.push_back(all.eq[r]);
+        if(rowUnder[r]) under.eq.push_back(all.eq[r]);
+    }
+    for(int col = 0; col < n; col++) {
+        if(colOver[col])  over.param.push_back(all.param[col]);
+        if(colUnder[col]) under.param.push_back(all.param[col]);
+    }
+    if(!over.eq.empty()) c->block.push_back(over);
+
+    // The square part, by Tarjan's algorithm for strongly connected
+    // components; that finds each component only after all the components
+    // that it depends on, which is the order that we want to solve them.
+    std::vector<int> index(m, -1), low(m, 0), sccStack;
+    std::vector<bool> onStack(m, false);
+    std::vector<std::pair<int, size_t>> call;
+    int counter = 0;
+    for(int root = 0; root < m; root++) {
+        if(rowOver[root] || rowUnder[root] || index[root] >= 0) continue;
+
+        call.push_back({ root, 0 });
+        while(!call.empty()) {
+            int row = call.back().first;
+            size_t &edge = call.back().second;
+            if(edge == 0) {
+                index[row] = low[row] = counter++;
+                sccStack.push_back(row);
+                onStack[row] = true;
+            }
+            bool descended = false;
+            while(edge < adj[row].size()) {
+                int col = adj[row][edge++];
+                if(colOver[col]) continue;
+                int next = colMatch[col];
+                if(index[next] < 0) {
+                    call.push_back({ next, 0 });
+                    descended = true;
+                    break;
+                } else if(onStack[next]) {
+                    low[row] = min(low[row], index[next]);
+                }
+            }
+            if(descended) continue;
+
+            if(low[row] == index[row]) {
+                Subsystem block;
+                int top;
+                do {
+                    top = sccStack.back();
+                    sccStack.pop_back();
+                    onStack[top] = false;
+                    block.eq.push_back(all.eq[top]);
+                    block.param.push_back(all.param[rowMatch[top]]);
+                } while(top != row);
+                std::sort(block.eq.begin(), block.eq.end());
+                std::sort(block.param.begin(), block.param.end());
+                c->block.push_back(block);
+            }
+            call.pop_back();
+            if(!call.empty()) {
+                int parent = call.back().first;
+                low[parent] = min(low[parent], low[row]);
+            }
+        }
+    }
+
+    if(!under.param.empty()) c->block.push_back(under);
 }
 
 bool System::IsDragged(hParam p) {
@@ -84,6 +366,22 @@ bool System::IsDragged(hParam p) {
     return false;
 }
 
+//-----------------------------------------------------------------------------
+// Solve the equations of the form a - b = 0 by substituting b for a. A param
+// may be substituted by one that's substituted itself later, so we follow
+// the chain to find what each param is now, and rewrite the equations just
+// once at the end.
+//-----------------------------------------------------------------------------
+hParam System::SubstitutedParam(hParam hp) {
+    Param *p;
+    while((p = param.FindByIdNoOops(hp)) && p->tag == VAR_SUBSTITUTED &&
+          p->substd.v != hp.v)
+    {
+        hp = p->substd;
+    }
+    return hp;
+}
+
 void System::SolveBySubstitution() {
     int i;
     for(i = 0; i < eq.n; i++) {
@@ -94,8 +392,8 @@ void System::SolveBySubstitution() {
            tex->a->op == Expr::Op::PARAM &&
            tex->b->op == Expr::Op::PARAM)
         {
-            hParam a = tex->a->parh;
-            hParam b = tex->b->parh;
+            hParam a = SubstitutedParam(tex->a->parh);
+            hParam b = SubstitutedParam(tex->b->parh);
             if(!(param.FindByIdNoOops(a) && param.FindByIdNoOops(b))) {
                 // Don't substitute unless they're both solver params;
                 // otherwise it's an equation that can be solved immediately,
@@ -110,17 +408,7 @@ void System::SolveBySubstitution() {
                 b = t;
             }
 
-            int j;
-            for(j = 0; j < eq.n; j++) {
-                Equation *req = &(eq.elem[j]);
-                (req->e)->Substitute(a, b); // A becomes B, B unchanged
-            }
-            for(j = 0; j < param.n; j++) {
-                Param *rp = &(param.elem[j]);
-                if(rp->substd.v == a.v) {
-                    rp->substd = b;
-                }
-            }
+            // A becomes B, B unchanged
             Param *ptr = param.FindById(a);
             ptr->tag = VAR_SUBSTITUTED;
             ptr->substd = b;
@@ -128,207 +416,305 @@ void System::SolveBySubstitution() {
             teq->tag = EQ_SUBSTITUTED;
         }
     }
+
+    for(i = 0; i < param.n; i++) {
+        Param *p = &(param.elem[i]);
+        if(p->tag == VAR_SUBSTITUTED) p->substd = SubstitutedParam(p->substd);
+    }
+    ApplySubstitutions();
 }
 
 //-----------------------------------------------------------------------------
-// Calculate the rank of the Jacobian matrix, by Gram-Schimdt orthogonalization
-// in place. A row (~equation) is considered to be all zeros if its magnitude
-// is less than the tolerance RANK_MAG_TOLERANCE.
+// Rewrite the equations in terms of the params that remain, once the
+// substituted params have their final substd.
 //-----------------------------------------------------------------------------
-int System::CalculateRank() {
-    // Actually work with magnitudes squared, not the magnitudes
-    double rowMag[MAX_UNKNOWNS] = {};
-    double tol = RANK_MAG_TOLERANCE*RANK_MAG_TOLERANCE;
-
-    int i, iprev, j;
-    int rank = 0;
-
-    for(i = 0; i < mat.m; i++) {
-        // Subtract off this row's component in the direction of any
-        // previous rows
-        for(iprev = 0; iprev < i; iprev++) {
-            if(rowMag[iprev] <= tol) continue; // ignore zero rows
-
-            double dot = 0;
-            for(j = 0; j < mat.n; j++) {
-                dot += (mat.A.num[iprev][j]) * (mat.A.num[i][j]);
-            }
-            for(j = 0; j < mat.n; j++) {
-                mat.A.num[i][j] -= (dot/rowMag[iprev])*mat.A.num[iprev][j];
-            }
-        }
-        // Our row is now normal to all previous rows; calculate the
-        // magnitude of what's left
-        double mag = 0;
-        for(j = 0; j < mat.n; j++) {
-            mag += (mat.A.num[i][j]) * (mat.A.num[i][j]);
-        }
-        if(mag > tol) {
-            rank++;
-        }
-        rowMag[i] = mag;
+static void SubstituteParams(Expr *e, ParamList *param) {
+    if(e->op == Expr::Op::PARAM) {
+        Param *p = param->FindByIdNoOops(e->parh);
+        if(p && p->tag == System::VAR_SUBSTITUTED) e->parh = p->substd;
     }
 
-    return rank;
+    int c = e->Children();
+    if(c > 0) SubstituteParams(e->a, param);
+    if(c > 1) SubstituteParams(e->b, param);
 }
 
-bool System::TestRank() {
-    EvalJacobian();
-    return CalculateRank() == mat.m;
+void System::ApplySubstitutions() {
+    for(int i = 0; i < eq.n; i++) {
+        SubstituteParams(eq.elem[i].e, &param);
+    }
 }
 
-bool System::SolveLinearSystem(double X[], double A[][MAX_UNKNOWNS],
-                               double B[], int n)
-{
-    // Gaussian elimination, with partial pivoting. It's an error if the
-    // matrix is singular, because that means two constraints are
-    // equivalent.
-    int i, j, ip, jp, imax = 0;
-    double max, temp;
-
-    for(i = 0; i < n; i++) {
-        // We are trying eliminate the term in column i, for rows i+1 and
-        // greater. First, find a pivot (between rows i and N-1).
-        max = 0;
-        for(ip = i; ip < n; ip++) {
-            if(ffabs(A[ip][i]) > max) {
-                imax = ip;
-                max = ffabs(A[ip][i]);
-            }
-        }
-        // Don't give up on a singular matrix unless it's really bad; the
-        // assumption code is responsible for identifying that condition,
-        // so we're not responsible for reporting that error.
-        if(ffabs(max) < 1e-20) continue;
+//-----------------------------------------------------------------------------
+// Write the (sparse) matrix A*A'. Entry (r, c) is the dot product of rows r
+// and c of A, so it's nonzero only if the two equations share a parameter.
+//-----------------------------------------------------------------------------
+void System::WriteNormalMatrix(Matrix *mat) {
+    int r, c, k, kc;
 
-        // Swap row imax with row i
-        for(jp = 0; jp < n; jp++) {
-            swap(A[i][jp], A[imax][jp]);
+    // Find the nonzero entries in each column of A, by transposing it.
+    std::vector<int> colStart(mat->n + 1, 0);
+    for(k = 0; k < (int)mat->A.col.size(); k++) {
+        colStart[mat->A.col[k] + 1]++;
+    }
+    for(c = 0; c < mat->n; c++) {
+        colStart[c + 1] += colStart[c];
+    }
+    std::vector<int> colRow(mat->A.col.size());
+    std::vector<double> colVal(mat->A.col.size());
+    std::vector<int> next(colStart.begin(), colStart.end() - 1);
+    for(r = 0; r < mat->m; r++) {
+        for(k = mat->A.row[r]; k < mat->A.row[r + 1]; k++) {
+            int at = next[mat->A.col[k]]++;
+            colRow[at] = r;
+            colVal[at] = mat->A.num[k];
         }
-        swap(B[i], B[imax]);
-
-        // For rows i+1 and greater, eliminate the term in column i.
-        for(ip = i+1; ip < n; ip++) {
-            temp = A[ip][i]/A[i][i];
+    }
 
-            for(jp = i; jp < n; jp++) {
-                A[ip][jp] -= temp*(A[i][jp]);
+    // And accumulate each row of A*A' from the columns its row of A touches.
+    mat->AAt.Clear(mat->m);
+    std::vector<double> sum(mat->m, 0.0);
+    std::vector<bool> touched(mat->m, false);
+    std::vector<int> cols;
+    for(r = 0; r < mat->m; r++) {
+        cols.clear();
+        for(k = mat->A.row[r]; k < mat->A.row[r + 1]; k++) {
+            c = mat->A.col[k];
+            for(kc = colStart[c]; kc < colStart[c + 1]; kc++) {
+                int rc = colRow[kc];
+                if(!touched[rc]) {
+                    touched[rc] = true;
+                    cols.push_back(rc);
+                }
+                sum[rc] += mat->A.num[k]*colVal[kc];
             }
-            B[ip] -= temp*B[i];
         }
-    }
-
-    // We've put the matrix in upper triangular form, so at this point we
-    // can solve by back-substitution.
-    for(i = n - 1; i >= 0; i--) {
-        if(ffabs(A[i][i]) < 1e-20) continue;
-
-        temp = B[i];
-        for(j = n - 1; j > i; j--) {
-            temp -= X[j]*A[i][j];
+        std::sort(cols.begin(), cols.end());
+        for(int rc : cols) {
+            mat->AAt.row[r].push_back({ rc, sum[rc] });
+            sum[rc] = 0;
+            touched[rc] = false;
         }
-        X[i] = temp / A[i][i];
     }
+}
 
-    return true;
+//-----------------------------------------------------------------------------
+// Calculate the rank of the Jacobian matrix. The magnitude (squared) of what's
+// left of each row after we subtract off its components in the direction of
+// the rows before it is exactly the corresponding pivot when we factor A*A',
+// so a row (~equation) is considered to be all zeros if that pivot is less
+// than the tolerance RANK_MAG_TOLERANCE (squared).
+//-----------------------------------------------------------------------------
+int System::CalculateRank(Matrix *mat) {
+    WriteNormalMatrix(mat);
+    mat->AAt.Factor(RANK_MAG_TOLERANCE*RANK_MAG_TOLERANCE);
+    return mat->AAt.rank;
+}
+
+bool System::TestRank(Matrix *mat) {
+    EvalJacobian(mat);
+    return CalculateRank(mat) == mat->m;
 }
 
-bool System::SolveLeastSquares() {
-    int r, c, i;
+//-----------------------------------------------------------------------------
+// Write and factor the matrix for the least squares step, damped by mu (as
+// in Levenberg-Marquardt) if that's nonzero. This scales the Jacobian in
+// place, so it must be evaluated again before anything else uses it.
+//-----------------------------------------------------------------------------
+void System::FactorLeastSquares(Matrix *mat, double mu) {
+    int c, k;
 
     // Scale the columns; this scale weights the parameters for the least
     // squares solve, so that we can encourage the solver to make bigger
     // changes in some parameters, and smaller in others.
-    for(c = 0; c < mat.n; c++) {
-        if(IsDragged(mat.param[c])) {
+    mat->scale.resize(mat->n);
+    for(c = 0; c < mat->n; c++) {
+        if(IsDragged(mat->param[c])) {
             // It's least squares, so this parameter doesn't need to be all
             // that big to get a large effect.
-            mat.scale[c] = 1/20.0;
+            mat->scale[c] = 1/20.0;
         } else {
-            mat.scale[c] = 1;
-        }
-        for(r = 0; r < mat.m; r++) {
-            mat.A.num[r][c] *= mat.scale[c];
+            mat->scale[c] = 1;
         }
     }
+    for(k = 0; k < (int)mat->A.num.size(); k++) {
+        mat->A.num[k] *= mat->scale[mat->A.col[k]];
+    }
 
-    // Write A*A'
-    for(r = 0; r < mat.m; r++) {
-        for(c = 0; c < mat.m; c++) {  // yes, AAt is square
-            double sum = 0;
-            for(i = 0; i < mat.n; i++) {
-                sum += mat.A.num[r][i]*mat.A.num[c][i];
+    // Write A*A', and factor it. Don't give up on a singular matrix unless
+    // it's really bad; the assumption code is responsible for identifying
+    // that condition, so we're not responsible for reporting that error.
+    WriteNormalMatrix(mat);
+    if(mu > 0) {
+        for(int r = 0; r < mat->m; r++) {
+            for(SparseSymmetricMatrix::Entry &en : mat->AAt.row[r]) {
+                if(en.col == r) en.val *= 1 + mu;
             }
-            mat.AAt[r][c] = sum;
         }
     }
+    mat->AAt.Factor(1e-20);
+}
 
-    if(!SolveLinearSystem(mat.Z, mat.AAt, mat.B.num, mat.m)) return false;
+//-----------------------------------------------------------------------------
+// Solve A*A'*Z = B, with the factored matrix, and multiply that by A' to get
+// the (minimum norm) least squares step X.
+//-----------------------------------------------------------------------------
+void System::SolveLeastSquares(Matrix *mat) {
+    int r, c, k;
 
-    // And multiply that by A' to get our solution.
-    for(c = 0; c < mat.n; c++) {
-        double sum = 0;
-        for(i = 0; i < mat.m; i++) {
-            sum += mat.A.num[i][c]*mat.Z[i];
+    mat->Z = mat->B.num;
+    mat->AAt.Solve(mat->Z.data());
+
+    mat->X.assign(mat->n, 0.0);
+    for(r = 0; r < mat->m; r++) {
+        for(k = mat->A.row[r]; k < mat->A.row[r + 1]; k++) {
+            mat->X[mat->A.col[k]] += mat->A.num[k]*mat->Z[r];
         }
-        mat.X[c] = sum * mat.scale[c];
     }
-    return true;
+    for(c = 0; c < mat->n; c++) {
+        mat->X[c] *= mat->scale[c];
+    }
 }
 
-bool System::NewtonSolve(int tag) {
-
-    int iter = 0;
-    bool converged = false;
-    int i;
+static double SumOfSquares(const std::vector<double> &v) {
+    double sum = 0;
+    for(double x : v) {
+        sum += x*x;
+    }
+    return sum;
+}
 
-    // Evaluate the functions at our operating point.
-    for(i = 0; i < mat.m; i++) {
-        mat.B.num[i] = (mat.B.sym[i])->Eval();
+bool System::IsConverged(Matrix *mat) {
+    for(int i = 0; i < mat->m; i++) {
+        if(isnan(mat->B.num[i])) return false;
+        if(ffabs(mat->B.num[i]) > CONVERGE_TOLERANCE) return false;
     }
-    do {
-        // And evaluate the Jacobian at our initial operating point.
-        EvalJacobian();
+    return true;
+}
 
-        if(!SolveLeastSquares()) break;
+//-----------------------------------------------------------------------------
+// Solve a block by Newton's method; it's the least squares (minimum norm)
+// step when there are more params than equations. Usually the full step
+// reduces the residual, and that's all we do. When it doesn't, we search
+// back along the step, and failing that, we damp it (Levenberg-Marquardt),
+// more and more until a step works, and less again as steps succeed. And
+// once we're converging quickly, we keep the factored Jacobian for the next
+// step, instead of evaluating and factoring it again.
+//-----------------------------------------------------------------------------
+bool System::NewtonSolve(Matrix *mat) {
+    int i, iter;
 
-        // Take the Newton step;
-        //      J(x_n) (x_{n+1} - x_n) = 0 - F(x_n)
-        for(i = 0; i < mat.n; i++) {
-            Param *p = param.FindById(mat.param[i]);
-            p->val -= mat.X[i];
-            if(isnan(p->val)) {
+    std::vector<Param *> p(mat->n);
+    for(i = 0; i < mat->n; i++) {
+        p[i] = param.FindById(mat->param[i]);
+    }
+    std::vector<double> x0(mat->n);
+
+    // Evaluate the functions and the Jacobian at our operating point.
+    EvalJacobian(mat);
+    if(IsConverged(mat)) return true;
+
+    double err = SumOfSquares(mat->B.num);
+    if(isnan(err)) return false;
+    double mu = 0;
+    bool fresh = true;
+    FactorLeastSquares(mat, mu);
+    for(iter = 0; iter < 50; iter++) {
+        SolveLeastSquares(mat);
+        for(i = 0; i < mat->n; i++) {
+            if(isnan(mat->X[i])) {
                 // Very bad, and clearly not convergent
                 return false;
             }
+            x0[i] = p[i]->val;
         }
 
-        // Re-evalute the functions, since the params have just changed.
-        for(i = 0; i < mat.m; i++) {
-            mat.B.num[i] = (mat.B.sym[i])->Eval();
+        // Take the Newton step;
+        //      J(x_n) (x_{n+1} - x_n) = 0 - F(x_n)
+        // or some fraction of it, if the whole step makes things worse.
+        double t = 1, newErr;
+        for(int tries = 0; ; tries++) {
+            for(i = 0; i < mat->n; i++) {
+                p[i]->val = x0[i] - t*mat->X[i];
+            }
+            EvalResiduals(mat);
+            newErr = SumOfSquares(mat->B.num);
+            if(newErr < err || tries == 4) break;
+            t /= 2;
         }
-        // Check for convergence
-        converged = true;
-        for(i = 0; i < mat.m; i++) {
-            if(isnan(mat.B.num[i])) {
-                return false;
+
+        if(!(newErr < err)) {
+            // Nothing along this step helps, so go back. If the Jacobian was
+            // left over from a previous step, then try again with a fresh one,
+            // otherwise damp the step more.
+            for(i = 0; i < mat->n; i++) {
+                p[i]->val = x0[i];
             }
-            if(ffabs(mat.B.num[i]) > CONVERGE_TOLERANCE) {
-                converged = false;
-                break;
+            if(fresh) {
+                mu = (mu == 0) ? 1e-3 : mu*10;
+                if(mu > 1e6) {
+                    EvalResiduals(mat);
+                    return false;
+                }
             }
+            EvalJacobian(mat);
+            FactorLeastSquares(mat, mu);
+            fresh = true;
+            continue;
         }
-    } while(iter++ < 50 && !converged);
 
-    return converged;
+        if(IsConverged(mat)) return true;
+
+        bool fast = (t == 1 && newErr < 1e-2*err);
+        err = newErr;
+        if(mu > 0) {
+            mu /= 10;
+            if(mu < 1e-6) mu = 0;
+        }
+        if(fast && mu == 0 && mat->m == mat->n) {
+            // Converging quickly, so the Jacobian hasn't changed much. But
+            // only when the solution is isolated; otherwise the minimum norm
+            // step depends on the Jacobian, and we'd end up somewhere else.
+            fresh = false;
+        } else {
+            EvalJacobian(mat);
+            FactorLeastSquares(mat, mu);
+            fresh = true;
+        }
+    }
+
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// Find the requests, constraints, and entities in each group, in the order
+// that they appear in the sketch. That's a single pass, where searching the
+// sketch for each group would be quadratic in the number of groups.
+//-----------------------------------------------------------------------------
+void Sketch::IndexGroups() {
+    groupItems.clear();
+    for(const Request &r : request) {
+        groupItems[r.group.v].request.push_back(r.h);
+    }
+    for(const auto &c : constraint) {
+        groupItems[c.group.v].constraint.push_back(c.h);
+    }
+    for(const auto &e : entity) {
+        groupItems[e.group.v].entity.push_back(e.h);
+    }
+}
+
+const Sketch::GroupItems &Sketch::ItemsInGroup(hGroup h) const {
+    static const GroupItems none = {};
+    auto it = groupItems.find(h.v);
+    return (it == groupItems.end()) ? none : it->second;
 }
 
 void System::WriteEquationsExceptFor(hConstraint hc, Group *g) {
-    int i;
+    const Sketch::GroupItems &items = SK.ItemsInGroup(g->h);
     // Generate all the equations from constraints in this group
-    for(i = 0; i < SK.constraint.n; i++) {
-        ConstraintBase *c = &(SK.constraint.elem[i]);
-        if(c->group.v != g->h.v) continue;
+    for(hConstraint hgc : items.constraint) {
+        ConstraintBase *c = SK.GetConstraint(hgc);
         if(c->h.v == hc.v) continue;
 
         if(c->HasLabel() && c->type != Constraint::Type::COMMENT &&
@@ -349,23 +735,164 @@ void System::WriteEquationsExceptFor(hConstraint hc, Group *g) {
         c->Generate(&eq);
     }
     // And the equations from entities
-    for(i = 0; i < SK.entity.n; i++) {
-        EntityBase *e = &(SK.entity.elem[i]);
-        if(e->group.v != g->h.v) continue;
-
-        e->GenerateEquations(&eq);
+    for(hEntity he : items.entity) {
+        SK.GetEntity(he)->GenerateEquations(&eq);
     }
     // And from the groups themselves
     g->GenerateEquations(&eq);
 }
 
+//-----------------------------------------------------------------------------
+// Test whether the given rows of some vectors (in our case, the basis of a
+// null space) are linearly independent, by Gaussian elimination with partial
+// pivoting. Each vector must already be scaled to unit magnitude.
+//-----------------------------------------------------------------------------
+static bool RowsHaveFullRank(const std::vector<std::vector<double>> &v,
+                             const std::vector<int> &rows, double tol)
+{
+    size_t k = v.size();
+    if(rows.size() < k) return false;
+
+    std::vector<std::vector<double>> M(rows.size());
+    for(size_t r = 0; r < rows.size(); r++) {
+        for(size_t c = 0; c < k; c++) {
+            M[r].push_back(v[c][rows[r]]);
+        }
+    }
+    for(size_t c = 0; c < k; c++) {
+        size_t best = c;
+        for(size_t r = c; r < M.size(); r++) {
+            if(ffabs(M[r][c]) > ffabs(M[best][c])) best = r;
+        }
+        if(ffabs(M[best][c]) < tol) return false;
+        std::swap(M[c], M[best]);
+        for(size_t r = c + 1; r < M.size(); r++) {
+            double f = M[r][c] / M[c][c];
+            for(size_t cc = c; cc < k; cc++) {
+                M[r][cc] -= f*M[c][cc];
+            }
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Find the constraints that we could remove to make the Jacobian full rank.
+// Only a constraint with equations in a cluster that failed the rank test
+// (or substituted away in to that cluster's params) can do that. The rows of
+// a cluster's Jacobian are dependent when some combination of them vanishes;
+// those combinations are the left null space, which comes from the same
+// factorization as the rank. Removing some rows fixes the rank exactly when
+// no combination is left without them, so when the null space basis has full
+// rank in just those rows. That doesn't work for the constraints that we
+// solved by substitution, since removing them changes the other rows, and
+// puts the params that they eliminated back; so that can fix a cluster whose
+// params they don't share now (e.g., when a param was substituted by itself).
+// For those, we write the equations again without them, and test the rank of
+// everything.
+//-----------------------------------------------------------------------------
 void System::FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad) {
-    int a, i;
+    int a, i, j;
+
+    // We're about to write the equations again, without each candidate.
+    eqGroup.v = 0;
+
+    enum {
+        NOT_TOUCHING   = 0,
+        FIXES          = 1,
+        DOESNT_FIX     = 2,
+        MUST_REWRITE   = 3
+    };
+
+    std::vector<bool> paramInBad(param.n, false);
+    std::vector<int> eqFailed(eq.n, -1), eqRow(eq.n, -1);
+    std::vector<std::vector<std::vector<double>>> nullSpace;
+    for(const Cluster &c : cluster) {
+        if(c.rankOk) continue;
+        for(int p : c.all.param) paramInBad[p] = true;
+
+        Matrix mat;
+        WriteJacobian(c.all, &mat);
+        EvalJacobian(&mat);
+        CalculateRank(&mat);
+
+        int f = (int)nullSpace.size();
+        nullSpace.emplace_back();
+        for(int r = 0; r < mat.m; r++) {
+            eqFailed[c.all.eq[r]] = f;
+            eqRow[c.all.eq[r]] = r;
+            if(!mat.AAt.dependent[r]) continue;
+
+            std::vector<double> y(mat.m);
+            mat.AAt.NullVector(r, y.data());
+            double mag = sqrt(SumOfSquares(y));
+            for(double &yv : y) {
+                yv /= mag;
+            }
+            nullSpace[f].push_back(y);
+        }
+    }
+
+    // A substituted param counts as part of the cluster that has the param
+    // that it was replaced by.
+    std::vector<bool> inBad(param.n, false);
+    for(i = 0; i < param.n; i++) {
+        Param *p = &(param.elem[i]);
+        j = (p->tag == VAR_SUBSTITUTED) ? param.IndexOf(p->substd) : i;
+        inBad[i] = (j >= 0 && paramInBad[j]);
+    }
+
+    std::vector<hParam> paramsUsed;
+    SK.constraint.ClearTags();
+    for(i = 0; i < eq.n; ) {
+        Equation *e = &(eq.elem[i]);
+        if(!e->h.isFromConstraint()) {
+            i++;
+            continue;
+        }
+
+        // The equations of a constraint are consecutive, since they're
+        // sorted by handle.
+        hConstraint hc = e->h.constraint();
+        std::vector<int> rows;
+        std::vector<std::vector<int>> failedRows(nullSpace.size());
+        bool touches = false, substituted = false;
+        for(; i < eq.n; i++) {
+            e = &(eq.elem[i]);
+            if(!e->h.isFromConstraint() || e->h.constraint().v != hc.v) break;
+
+            if(e->tag == EQ_SUBSTITUTED) substituted = true;
+            if(eqFailed[i] >= 0) {
+                touches = true;
+                failedRows[eqFailed[i]].push_back(eqRow[i]);
+            }
+            paramsUsed.clear();
+            e->e->ParamsUsedList(&paramsUsed);
+            for(hParam hp : paramsUsed) {
+                j = param.IndexOf(hp);
+                if(j >= 0 && inBad[j]) touches = true;
+            }
+        }
+        if(!touches && !substituted) continue;
+
+        ConstraintBase *c = SK.constraint.FindByIdNoOops(hc);
+        if(!c) continue;
+        if(substituted) {
+            c->tag = MUST_REWRITE;
+            continue;
+        }
+        c->tag = FIXES;
+        for(size_t f = 0; f < nullSpace.size(); f++) {
+            if(!RowsHaveFullRank(nullSpace[f], failedRows[f], RANK_MAG_TOLERANCE)) {
+                c->tag = DOESNT_FIX;
+            }
+        }
+    }
 
     for(a = 0; a < 2; a++) {
-        for(i = 0; i < SK.constraint.n; i++) {
-            ConstraintBase *c = &(SK.constraint.elem[i]);
-            if(c->group.v != g->h.v) continue;
+        for(hConstraint hgc : SK.ItemsInGroup(g->h).constraint) {
+            ConstraintBase *c = SK.GetConstraint(hgc);
+            if(c->tag == NOT_TOUCHING || c->tag == DOESNT_FIX) continue;
             if((c->type == Constraint::Type::POINTS_COINCIDENT && a == 0) ||
                (c->type != Constraint::Type::POINTS_COINCIDENT && a == 1))
             {
@@ -375,6 +902,14 @@ void System::FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad) {
                 continue;
             }
 
+            if(c->tag == FIXES) {
+                bad->Add(&(c->h));
+                continue;
+            }
+
+            // The equations for each candidate are needed only until we've
+            // tested it, so give back their memory as we go.
+            TemporaryScope scope;
             param.ClearTags();
             eq.Clear();
             WriteEquationsExceptFor(c->h, g);
@@ -384,25 +919,200 @@ void System::FindWhichToRemoveToFixJacobian(Group *g, List<hConstraint> *bad) {
             // and that doesn't break anything.
             SolveBySubstitution();
 
-            WriteJacobian(0);
-            EvalJacobian();
+            Subsystem ss;
+            for(j = 0; j < eq.n; j++) {
+                Equation *e = &(eq.elem[j]);
+                if(e->tag != 0) continue;
+
+                paramsUsed.clear();
+                e->e->ParamsUsedList(&paramsUsed);
+                ss.eq.push_back(j);
+                for(hParam hp : paramsUsed) {
+                    int k = param.IndexOf(hp);
+                    if(k >= 0 && param.elem[k].tag == 0) ss.param.push_back(k);
+                }
+            }
+            std::sort(ss.param.begin(), ss.param.end());
+            ss.param.erase(std::unique(ss.param.begin(), ss.param.end()),
+                           ss.param.end());
 
-            int rank = CalculateRank();
-            if(rank == mat.m) {
+            Matrix mat;
+            WriteJacobian(ss, &mat);
+            if(TestRank(&mat)) {
                 // We fixed it by removing this constraint
                 bad->Add(&(c->h));
             }
+            eq.Clear();
         }
     }
 }
 
+//-----------------------------------------------------------------------------
+// The Jacobian of the whole cluster is needed less often than the blocks',
+// so it's written only when we first need it, and then kept the same way.
+//-----------------------------------------------------------------------------
+void System::WriteClusterJacobian(Cluster *c) {
+    if(c->matWritten) return;
+    WriteJacobian(c->all, &(c->mat));
+    c->matWritten = true;
+}
+
+//-----------------------------------------------------------------------------
+// Solve one cluster, block by block, and rank-test it. The clusters share no
+// params, so this may run for several of them at once on different threads.
+//-----------------------------------------------------------------------------
+void System::SolveCluster(Cluster *c) {
+    // The Jacobian of each block is written once, and then reused for as
+    // long as the cluster is.
+    if(c->blockMat.size() != c->block.size()) {
+        c->blockMat.resize(c->block.size());
+        for(size_t i = 0; i < c->block.size(); i++) {
+            WriteJacobian(c->block[i], &(c->blockMat[i]));
+        }
+    }
+
+    std::vector<double> initial;
+    for(int p : c->all.param) {
+        initial.push_back(param.elem[p].val);
+    }
+
+    // Do a rank test on each block; that tells us if the block is
+    // inconsistently constrained. If every block of the cluster is fine then
+    // so is the cluster, by its triangular form.
+    c->converged = true;
+    c->rankOk = true;
+    for(size_t i = 0; i < c->block.size(); i++) {
+        Matrix *mat = &(c->blockMat[i]);
+        bool rankOkBefore = TestRank(mat);
+
+        if(!NewtonSolve(mat)) {
+            // Leave the residuals as they are, so that we can report which
+            // equations aren't satisfied.
+            c->converged = false;
+            c->failedMat = mat;
+            if(!rankOkBefore) c->rankOk = false;
+            break;
+        }
+
+        if(!TestRank(mat)) c->rankOk = false;
+    }
+    if(!c->converged) {
+        if(c->block.size() == 1) return;
+
+        // Solving block by block moves the params of the earlier blocks
+        // before the later ones, which can leave a later block far from
+        // its solution, or on the wrong side of a singularity. So try again
+        // with the whole cluster at once, from where we started.
+        for(size_t k = 0; k < initial.size(); k++) {
+            param.elem[c->all.param[k]].val = initial[k];
+        }
+        WriteClusterJacobian(c);
+        bool rankOkBefore = TestRank(&(c->mat));
+        c->converged = NewtonSolve(&(c->mat));
+        if(!c->converged) {
+            c->failedMat = &(c->mat);
+            c->rankOk = rankOkBefore;
+        } else {
+            c->rankOk = TestRank(&(c->mat));
+        }
+        return;
+    }
+    if(!c->rankOk && c->block.size() > 1) {
+        // But a block that's singular on its own may still be fine when
+        // we consider the params of the blocks before it.
+        WriteClusterJacobian(c);
+        c->rankOk = TestRank(&(c->mat));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Find the params of a (converged and consistently constrained) cluster that
+// are free. A param is free if the Jacobian still has full rank without its
+// column a, which is when the unit vector along that param doesn't lie in
+// the row space of the Jacobian. Its projection on to the row space has
+// magnitude (squared) a'*(A*A')^-1*a, so one factorization of A*A' gives us
+// every param.
+//-----------------------------------------------------------------------------
+void System::FindFreeParams(Cluster *c) {
+    Matrix *mat = &(c->mat);
+    WriteClusterJacobian(c);
+    EvalJacobian(mat);
+    CalculateRank(mat);
+
+    int r, k;
+    std::vector<std::vector<SparseSymmetricMatrix::Entry>> column(mat->n);
+    for(r = 0; r < mat->m; r++) {
+        for(k = mat->A.row[r]; k < mat->A.row[r + 1]; k++) {
+            column[mat->A.col[k]].push_back({ r, mat->A.num[k] });
+        }
+    }
+
+    std::vector<double> x;
+    for(int j = 0; j < mat->n; j++) {
+        x.assign(mat->m, 0.0);
+        for(const SparseSymmetricMatrix::Entry &e : column[j]) {
+            x[e.col] = e.val;
+        }
+        double inRowSpace = mat->AAt.InverseQuadraticForm(x.data());
+        if(1 - inRowSpace > RANK_MAG_TOLERANCE*RANK_MAG_TOLERANCE) {
+            param.elem[c->all.param[j]].free = true;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write everything that the substitution and clustering and compiled
+// Jacobians depend on: the params and equations, with every param that we're
+// not solving for by its value, and the dragged params.
+//-----------------------------------------------------------------------------
+static void WriteExprSignature(const Expr *e, ParamList *param,
+                               std::vector<uint64_t> *sig)
+{
+    sig->push_back((uint64_t)e->op);
+    if(e->op == Expr::Op::PARAM) {
+        sig->push_back(e->parh.v);
+        if(!param->FindByIdNoOops(e->parh)) {
+            Param *p = SK.param.FindByIdNoOops(e->parh);
+            uint64_t bits = 0;
+            if(p && p->known) memcpy(&bits, &(p->val), sizeof(double));
+            sig->push_back(p ? (p->known ? 2 : 1) : 0);
+            sig->push_back(bits);
+        }
+    } else if(e->op == Expr::Op::CONSTANT) {
+        uint64_t bits;
+        memcpy(&bits, &(e->v), sizeof(double));
+        sig->push_back(bits);
+    }
+
+    int c = e->Children();
+    if(c > 0) WriteExprSignature(e->a, param, sig);
+    if(c > 1) WriteExprSignature(e->b, param, sig);
+}
+
+void System::WriteSignature(std::vector<uint64_t> *sig) {
+    int i;
+    sig->clear();
+    sig->push_back(param.n);
+    for(i = 0; i < param.n; i++) {
+        sig->push_back(param.elem[i].h.v);
+    }
+    sig->push_back(eq.n);
+    for(i = 0; i < eq.n; i++) {
+        sig->push_back(eq.elem[i].h.v);
+        WriteExprSignature(eq.elem[i].e, &param, sig);
+    }
+    sig->push_back(dragged.n);
+    for(i = 0; i < dragged.n; i++) {
+        sig->push_back(dragged.elem[i].v);
+    }
+}
+
 SolveResult System::Solve(Group *g, int *dof, List<hConstraint> *bad,
                   bool andFindBad, bool andFindFree)
 {
     WriteEquationsExceptFor(Constraint::NO_CONSTRAINT, g);
 
     int i;
-    bool rankOk;
 
 /*
     dbp("%d equations", eq.n);
@@ -414,52 +1124,107 @@ SolveResult System::Solve(Group *g, int *dof, List<hConstraint> *bad,
         dbp("   param %08x at %.3f", param.elem[i].h.v, param.elem[i].val);
     } */
 
-    // All params and equations are assigned to group zero.
+    // All params and equations are to be solved.
     param.ClearTags();
     eq.ClearTags();
 
-    SolveBySubstitution();
+    // If the equations are the same as the last time that we solved this
+    // group, then so is everything that we did to them before solving
+    // numerically.
+    Compiled *cc = &compiled[g->h.v];
+    std::vector<uint64_t> signature;
+    WriteSignature(&signature);
+    if(signature == cc->signature) {
+        for(i = 0; i < param.n; i++) {
+            param.elem[i].tag    = cc->paramTag[i];
+            param.elem[i].substd = cc->paramSubstd[i];
+        }
+        for(i = 0; i < eq.n; i++) {
+            eq.elem[i].tag = cc->eqTag[i];
+        }
+        // The compiled Jacobians don't need this, but anything that we
+        // write from the equations afresh does.
+        ApplySubstitutions();
+        cluster.swap(cc->cluster);
+        for(Cluster &c : cluster) {
+            for(Matrix &mat : c.blockMat) {
+                mat.tape.BindParams(&param, &(SK.param));
+            }
+            if(c.matWritten) c.mat.tape.BindParams(&param, &(SK.param));
+        }
+    } else {
+        SolveBySubstitution();
+
+        // What's left breaks into independent clusters, and often most of
+        // them are tiny.
+        FindClusters();
+
+        cc->signature = std::move(signature);
+        cc->paramTag.resize(param.n);
+        cc->paramSubstd.resize(param.n);
+        for(i = 0; i < param.n; i++) {
+            cc->paramTag[i]    = param.elem[i].tag;
+            cc->paramSubstd[i] = param.elem[i].substd;
+        }
+        cc->eqTag.resize(eq.n);
+        for(i = 0; i < eq.n; i++) {
+            cc->eqTag[i] = eq.elem[i].tag;
+        }
+    }
 
-    // Before solving the big system, see if we can find any equations that
-    // are soluble alone. This can be a huge speedup. We don't know whether
-    // the system is consistent yet, but if it isn't then we'll catch that
-    // later.
-    int alone = 1;
-    for(i = 0; i < eq.n; i++) {
-        Equation *e = &(eq.elem[i]);
-        if(e->tag != 0) continue;
+    // Unless we have to write the equations again to find the bad
+    // constraints, they'll stay as we compiled them.
+    eqGroup = g->h;
+    SolveResult how = SolveClusters(g, dof, bad, andFindBad, andFindFree);
 
-        hParam hp = e->e->ReferencedParams(&param);
-        if(hp.v == Expr::NO_PARAMS.v) continue;
-        if(hp.v == Expr::MULTIPLE_PARAMS.v) continue;
+    cc->cluster.swap(cluster);
+    cluster.clear();
+    return how;
+}
 
-        Param *p = param.FindById(hp);
-        if(p->tag != 0) continue; // let rank test catch inconsistency
+bool System::CanSolveAgain(Group *g) {
+    return eqGroup.v != 0 && eqGroup.v == g->h.v;
+}
 
-        e->tag = alone;
-        p->tag = alone;
-        WriteJacobian(alone);
-        if(!NewtonSolve(alone)) {
-            // Failed to converge, bail out early
-            goto didnt_converge;
-        }
-        alone++;
-    }
+SolveResult System::SolveAgain(Group *g, int *dof, List<hConstraint> *bad,
+                               bool andFindBad, bool andFindFree)
+{
+    ssassert(CanSolveAgain(g), "Equations aren't compiled for this group");
 
-    // Now write the Jacobian for what's left, and do a rank test; that
-    // tells us if the system is inconsistently constrained.
-    if(!WriteJacobian(0)) {
-        return SolveResult::TOO_MANY_UNKNOWNS;
+    // The compiled Jacobians point at our params, which are all still
+    // there; just start them from their new values.
+    Compiled *cc = &compiled[g->h.v];
+    for(int i = 0; i < param.n; i++) {
+        Param *p = &(param.elem[i]);
+        p->val = SK.GetParam(p->h)->val;
+        p->tag = cc->paramTag[i];
     }
 
-    rankOk = TestRank();
+    cluster.swap(cc->cluster);
+    SolveResult how = SolveClusters(g, dof, bad, andFindBad, andFindFree);
+
+    cc->cluster.swap(cluster);
+    cluster.clear();
+    return how;
+}
 
-    // And do the leftovers as one big system
-    if(!NewtonSolve(0)) {
-        goto didnt_converge;
+SolveResult System::SolveClusters(Group *g, int *dof, List<hConstraint> *bad,
+                                  bool andFindBad, bool andFindFree)
+{
+    int i;
+    bool rankOk = true, converged = true;
+
+    // The clusters are independent, so solve them at the same time.
+    ThreadPool::ParallelFor((int)cluster.size(), [&](int ci) {
+        SolveCluster(&cluster[ci]);
+    });
+
+    for(const Cluster &c : cluster) {
+        if(!c.converged) converged = false;
+        if(!c.rankOk) rankOk = false;
     }
+    if(!converged) goto didnt_converge;
 
-    rankOk = TestRank();
     if(!rankOk) {
         if(!g->allowRedundant) {
             if(andFindBad) FindWhichToRemoveToFixJacobian(g, bad);
@@ -467,30 +1232,36 @@ SolveResult System::Solve(Group *g, int *dof, List<hConstraint> *bad,
         }
     }
 
-    // This is not the full Jacobian, but any substitutions or single-eq
-    // solves removed one equation and one unknown, therefore no effect
-    // on the number of DOF.
-    if(dof) *dof = mat.n - mat.m;
+    // Any substitutions removed one equation and one unknown, therefore no
+    // effect on the number of DOF.
+    if(dof) {
+        *dof = 0;
+        for(i = 0; i < param.n; i++) {
+            if(param.elem[i].tag == 0) (*dof)++;
+        }
+        for(i = 0; i < eq.n; i++) {
+            if(eq.elem[i].tag == 0) (*dof)--;
+        }
+    }
 
     // If requested, find all the free (unbound) variables. This might be
     // more than the number of degrees of freedom. Don't always do this,
-    // because the display would get annoying and it's slow.
+    // because the display would get annoying and it's slow. A param that
+    // no equation references is always free, and the others are tested
+    // within their own cluster.
     for(i = 0; i < param.n; i++) {
         Param *p = &(param.elem[i]);
-        p->free = false;
-
-        if(andFindFree) {
-            if(p->tag == 0) {
-                p->tag = VAR_DOF_TEST;
-                WriteJacobian(0);
-                EvalJacobian();
-                int rank = CalculateRank();
-                if(rank == mat.m) {
-                    p->free = true;
-                }
-                p->tag = 0;
+        p->free = andFindFree && (p->tag == 0);
+    }
+    if(andFindFree) {
+        for(const Cluster &c : cluster) {
+            for(int p : c.all.param) {
+                param.elem[p].free = false;
             }
         }
+        ThreadPool::ParallelFor((int)cluster.size(), [&](int ci) {
+            if(cluster[ci].rankOk) FindFreeParams(&cluster[ci]);
+        });
     }
 
     // System solved correctly, so write the new values back in to the
@@ -512,19 +1283,24 @@ SolveResult System::Solve(Group *g, int *dof, List<hConstraint> *bad,
 
 didnt_converge:
     SK.constraint.ClearTags();
-    for(i = 0; i < eq.n; i++) {
-        if(ffabs(mat.B.num[i]) > CONVERGE_TOLERANCE || isnan(mat.B.num[i])) {
-            // This constraint is unsatisfied.
-            if(!mat.eq[i].isFromConstraint()) continue;
-
-            hConstraint hc = mat.eq[i].constraint();
-            ConstraintBase *c = SK.constraint.FindByIdNoOops(hc);
-            if(!c) continue;
-            // Don't double-show constraints that generated multiple
-            // unsatisfied equations
-            if(!c->tag) {
-                bad->Add(&(c->h));
-                c->tag = 1;
+    for(const Cluster &cl : cluster) {
+        if(cl.converged) continue;
+
+        const Matrix &mat = *cl.failedMat;
+        for(i = 0; i < mat.m; i++) {
+            if(ffabs(mat.B.num[i]) > CONVERGE_TOLERANCE || isnan(mat.B.num[i])) {
+                // This constraint is unsatisfied.
+                if(!mat.eq[i].isFromConstraint()) continue;
+
+                hConstraint hc = mat.eq[i].constraint();
+                ConstraintBase *c = SK.constraint.FindByIdNoOops(hc);
+                if(!c) continue;
+                // Don't double-show constraints that generated multiple
+                // unsatisfied equations
+                if(!c->tag) {
+                    bad->Add(&(c->h));
+                    c->tag = 1;
+                }
             }
         }
     }
@@ -537,4 +1313,18 @@ void System::Clear() {
     param.Clear();
     eq.Clear();
     dragged.Clear();
+    eqGroup.v = 0;
+    compiled.clear();
+}
+
+// Forget what we compiled for any groups that no longer exist.
+void System::PruneCompiled() {
+    for(auto it = compiled.begin(); it != compiled.end();) {
+        hGroup hg = { it->first };
+        if(SK.group.FindByIdNoOops(hg)) {
+            ++it;
+        } else {
+            it = compiled.erase(it);
+        }
+    }
 }
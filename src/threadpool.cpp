@@ -0,0 +1,189 @@
+//-----------------------------------------------------------------------------
+// A work-stealing pool of worker threads. Each thread (the caller of
+// ParallelFor counts as one) has its own queue of work items; it takes them
+// from the front of its own queue, and when that's empty, steals them from
+// the back of the others.
+//-----------------------------------------------------------------------------
+#include "solvespace.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+struct Job {
+    const std::function<void(int)> *fn;
+    std::atomic<int>                remaining;
+};
+
+struct Task {
+    Job     *job;
+    int     index;
+};
+
+struct TaskQueue {
+    std::mutex          mutex;
+    std::deque<Task>    tasks;
+};
+
+// How many ParallelFors this thread is inside of; the workers always are,
+// and the caller while it's running its own share of the work.
+thread_local int ParallelDepth = 0;
+
+class Pool {
+public:
+    std::vector<std::thread>                    workers;
+    // The queue for the caller of ParallelFor is first, then the workers.
+    std::vector<std::unique_ptr<TaskQueue>>     queue;
+
+    std::mutex              mutex;
+    std::condition_variable wake, done;
+    int                     pending = 0;
+    bool                    exiting = false;
+
+    // Held for the duration of a ParallelFor, since there's only one set of
+    // queues.
+    std::mutex              busy;
+
+    Pool() {
+        int n = (int)std::thread::hardware_concurrency() - 1;
+        if(n < 0) n = 0;
+        for(int i = 0; i <= n; i++) {
+            queue.emplace_back(new TaskQueue);
+        }
+        for(int i = 1; i <= n; i++) {
+            workers.emplace_back([this, i] { Work(i); });
+        }
+    }
+
+    ~Pool() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            exiting = true;
+        }
+        wake.notify_all();
+        for(std::thread &t : workers) {
+            t.join();
+        }
+    }
+
+    bool Take(int self, Task *t) {
+        for(size_t k = 0; k < queue.size(); k++) {
+            TaskQueue *q = queue[(self + k) % queue.size()].get();
+            std::unique_lock<std::mutex> lock(q->mutex);
+            if(q->tasks.empty()) continue;
+            if(k == 0) {
+                *t = q->tasks.front();
+                q->tasks.pop_front();
+            } else {
+                *t = q->tasks.back();
+                q->tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool RunOne(int self) {
+        Task t;
+        if(!Take(self, &t)) return false;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            pending--;
+        }
+        (*t.job->fn)(t.index);
+        if(--t.job->remaining == 0) {
+            std::unique_lock<std::mutex> lock(mutex);
+            done.notify_all();
+        }
+        return true;
+    }
+
+    void Work(int self) {
+        ParallelDepth++;
+        for(;;) {
+            if(RunOne(self)) continue;
+
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return exiting || pending > 0; });
+            if(exiting) break;
+        }
+    }
+
+    void Run(int n, const std::function<void(int)> &fn) {
+        Job job;
+        job.fn = &fn;
+        job.remaining = n;
+
+        // Deal the items out round-robin, so that each thread starts on
+        // its own share without having to steal.
+        for(int i = 0; i < n; i++) {
+            TaskQueue *q = queue[i % queue.size()].get();
+            std::unique_lock<std::mutex> lock(q->mutex);
+            q->tasks.push_back({ &job, i });
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            pending += n;
+        }
+        wake.notify_all();
+
+        while(job.remaining > 0) {
+            if(RunOne(0)) continue;
+
+            // Nothing left to take, but the workers are still finishing up.
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [&job] { return job.remaining == 0; });
+        }
+    }
+};
+
+Pool *GetPool() {
+    static Pool pool;
+    return &pool;
+}
+
+}
+
+int ThreadPool::Concurrency() {
+    return (int)GetPool()->queue.size();
+}
+
+void ThreadPool::ParallelFor(int n, const std::function<void(int)> &fn) {
+    Pool *pool = GetPool();
+    // Check the depth first; the caller of a ParallelFor holds busy, so it
+    // mustn't try to lock that again.
+    if(n > 1 && !pool->workers.empty() && ParallelDepth == 0 &&
+       pool->busy.try_lock()) {
+        // The work runs as if it were on the calling thread, allocating its
+        // temporaries from the same heap (and, in the library, solving the
+        // same sketch).
+        TempHeap *heap = GetTemporaryHeap();
+#ifdef LIBRARY
+        Sketch *sketch = ActiveSketch;
+#endif
+        std::function<void(int)> asCaller = [&](int i) {
+            TempHeap *prevHeap = SetTemporaryHeap(heap);
+#ifdef LIBRARY
+            Sketch *prevSketch = ActiveSketch;
+            ActiveSketch = sketch;
+#endif
+            fn(i);
+            SetTemporaryHeap(prevHeap);
+#ifdef LIBRARY
+            ActiveSketch = prevSketch;
+#endif
+        };
+        ParallelDepth++;
+        pool->Run(n, asCaller);
+        ParallelDepth--;
+        pool->busy.unlock();
+    } else {
+        for(int i = 0; i < n; i++) {
+            fn(i);
+        }
+    }
+}
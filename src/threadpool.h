@@ -0,0 +1,23 @@
+//-----------------------------------------------------------------------------
+// A pool of worker threads, used to run independent pieces of work (like
+// the clusters of a constraint system) at the same time.
+//-----------------------------------------------------------------------------
+
+#ifndef __THREADPOOL_H
+#define __THREADPOOL_H
+
+class ThreadPool {
+public:
+    // The number of threads that can run work at once, including the caller.
+    static int Concurrency();
+
+    // Call fn(i) for each i in [0, n), in any order and on any thread, and
+    // return once all of them are done. Each thread allocates its temporaries
+    // separately, but on the caller's current temporary heap, so they're all
+    // freed along with the caller's.
+    // A ParallelFor from within fn(), or while another one is running, just
+    // runs serially on the calling thread.
+    static void ParallelFor(int n, const std::function<void(int)> &fn);
+};
+
+#endif
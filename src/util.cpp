@@ -6,6 +6,11 @@
 //-----------------------------------------------------------------------------
 #include "solvespace.h"
 
+#include <cstddef>
+#include <queue>
+#include <mutex>
+#include <thread>
+
 std::string SolveSpace::ssprintf(const char *fmt, ...)
 {
     va_list va;
@@ -91,6 +96,241 @@ void SolveSpace::MakeMatrix(double *mat,
     mat[15] = a44;
 }
 
+//-----------------------------------------------------------------------------
+// Hashes, to tell whether the inputs to something that we cached have changed.
+// A collision would leave us with a stale result, so mix the bits thoroughly.
+//-----------------------------------------------------------------------------
+uint64_t SolveSpace::HashMix(uint64_t h, uint64_t v) {
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdULL;
+    v ^= v >> 33;
+    v *= 0xc4ceb9fe1a85ec53ULL;
+    v ^= v >> 33;
+    h ^= v;
+    h = (h << 27) | (h >> 37);
+    return h*5 + 0x52dce729;
+}
+
+uint64_t SolveSpace::HashDouble(uint64_t h, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return HashMix(h, bits);
+}
+
+//-----------------------------------------------------------------------------
+// A separate heap, on which we allocate expressions and everything else that
+// lives only until the next regeneration. That makes it possible to be sloppy
+// with our memory management, and just free everything at once at the end.
+// Each thread has its own arena in each heap, so that worker threads can
+// allocate without locking; freeing a heap frees all of them, so it must be
+// done only while no other thread is allocating from it. Usually everything
+// goes on the default heap, but a thread can make some other heap current, to
+// free its temporaries independently of the others.
+//
+// An arena is a stack of large chunks, and we allocate by bumping a pointer
+// in the top one. The memory is zeroed when it's given back instead of when
+// it's allocated, so that a fresh chunk (from calloc) costs nothing extra.
+// Anything too big to share a chunk gets one of its own, so that it can be
+// freed individually.
+//-----------------------------------------------------------------------------
+namespace SolveSpace {
+
+struct alignas(std::max_align_t) TempChunk {
+    TempChunk  *next;       // the chunk below this one in the stack
+    size_t      size;       // bytes of memory after this header
+    size_t      used;
+    uint64_t    serial;     // order of allocation, for the big ones
+};
+
+struct TempArena {
+    TempChunk  *chunk;      // the one that we're allocating from, then older
+    TempChunk  *big;        // the big allocations, newest first
+    TempChunk  *spare;      // an empty chunk, kept to save a calloc
+    uint64_t    bigSerial;
+};
+
+struct TempHeap {
+    std::mutex                                          mutex;
+    std::unordered_map<std::thread::id, TempArena *>    arena;
+};
+
+static const size_t TEMP_CHUNK_SIZE = 1024*1024 - sizeof(TempChunk);
+static const size_t TEMP_BIG_SIZE   = TEMP_CHUNK_SIZE / 16;
+
+static TempHeap DefaultTempHeap;
+static thread_local TempHeap *CurrentTempHeap = NULL;
+// This thread's arena in the current heap, or NULL until we need it.
+static thread_local TempArena *Arena = NULL;
+
+static TempArena *GetArena() {
+    if(!Arena) {
+        TempHeap *heap = CurrentTempHeap ? CurrentTempHeap : &DefaultTempHeap;
+        std::unique_lock<std::mutex> lock(heap->mutex);
+        TempArena *&arena = heap->arena[std::this_thread::get_id()];
+        if(!arena) arena = new TempArena {};
+        Arena = arena;
+    }
+    return Arena;
+}
+
+static uint8_t *ChunkData(TempChunk *c) {
+    return (uint8_t *)&c[1];
+}
+
+static TempChunk *AllocChunk(size_t size) {
+    TempChunk *c = (TempChunk *)calloc(1, sizeof(TempChunk) + size);
+    ssassert(c != NULL, "Cannot allocate memory");
+    c->size = size;
+    return c;
+}
+
+// Zero what was used of a chunk, and keep it for later if we don't already
+// have a spare.
+static void RecycleChunk(TempArena *arena, TempChunk *c) {
+    if(arena->spare) {
+        free(c);
+        return;
+    }
+    memset(ChunkData(c), 0, c->used);
+    c->used = 0;
+    c->next = NULL;
+    arena->spare = c;
+}
+
+static void FreeArena(TempArena *arena) {
+    while(arena->chunk) {
+        TempChunk *c = arena->chunk;
+        arena->chunk = c->next;
+        RecycleChunk(arena, c);
+    }
+    while(arena->big) {
+        TempChunk *c = arena->big;
+        arena->big = c->next;
+        free(c);
+    }
+}
+
+TempHeap *CreateTemporaryHeap() {
+    return new TempHeap;
+}
+
+void DestroyTemporaryHeap(TempHeap *heap) {
+    FreeTemporaryHeap(heap);
+    for(auto &it : heap->arena) {
+        free(it.second->spare);
+        delete it.second;
+    }
+    delete heap;
+}
+
+TempHeap *GetTemporaryHeap() {
+    return CurrentTempHeap;
+}
+
+TempHeap *SetTemporaryHeap(TempHeap *heap) {
+    TempHeap *prev = CurrentTempHeap;
+    if(heap != prev) {
+        CurrentTempHeap = heap;
+        Arena = NULL;
+    }
+    return prev;
+}
+
+void *AllocTemporary(size_t n) {
+    TempArena *arena = GetArena();
+    const size_t align = alignof(std::max_align_t);
+    n = (n + align - 1) & ~(align - 1);
+
+    if(n > TEMP_BIG_SIZE) {
+        TempChunk *c = AllocChunk(n);
+        c->used   = n;
+        c->serial = arena->bigSerial++;
+        c->next   = arena->big;
+        arena->big = c;
+        return ChunkData(c);
+    }
+
+    TempChunk *c = arena->chunk;
+    if(!c || c->size - c->used < n) {
+        if(arena->spare) {
+            c = arena->spare;
+            arena->spare = NULL;
+        } else {
+            c = AllocChunk(TEMP_CHUNK_SIZE);
+        }
+        c->next = arena->chunk;
+        arena->chunk = c;
+    }
+    void *v = ChunkData(c) + c->used;
+    c->used += n;
+    return v;
+}
+
+// Only a big allocation is really freed here; the others stay until their
+// heap is freed, or their scope is released. Either way, this must be done
+// on the thread and heap that allocated it.
+void FreeTemporary(void *p) {
+    TempArena *arena = GetArena();
+    for(TempChunk **c = &(arena->big); *c; c = &((*c)->next)) {
+        if(ChunkData(*c) != p) continue;
+        TempChunk *f = *c;
+        *c = f->next;
+        free(f);
+        return;
+    }
+}
+
+void FreeTemporaryHeap(TempHeap *heap) {
+    std::unique_lock<std::mutex> lock(heap->mutex);
+    for(auto &it : heap->arena) {
+        FreeArena(it.second);
+    }
+}
+
+void FreeAllTemporary() {
+    FreeTemporaryHeap(&DefaultTempHeap);
+#if defined(WIN32)
+    // This is a good place to validate, because it gets called fairly
+    // often.
+    vl();
+#endif
+}
+
+TempMark MarkTemporary() {
+    TempArena *arena = GetArena();
+    TempMark mark = {};
+    mark.arena     = arena;
+    mark.chunk     = arena->chunk;
+    mark.used      = arena->chunk ? arena->chunk->used : 0;
+    mark.bigSerial = arena->bigSerial;
+    return mark;
+}
+
+void ReleaseTemporary(const TempMark &mark) {
+    TempArena *arena = mark.arena;
+    ssassert(arena == GetArena(),
+             "Temporaries must be released on the heap and thread that marked them");
+
+    while(arena->chunk != mark.chunk) {
+        ssassert(arena->chunk != NULL, "Released a mark that's already gone");
+        TempChunk *c = arena->chunk;
+        arena->chunk = c->next;
+        RecycleChunk(arena, c);
+    }
+    if(mark.chunk) {
+        memset(ChunkData(mark.chunk) + mark.used, 0, mark.chunk->used - mark.used);
+        mark.chunk->used = mark.used;
+    }
+    // The big ones are newest first, even after some were freed individually.
+    while(arena->big && arena->big->serial >= mark.bigSerial) {
+        TempChunk *c = arena->big;
+        arena->big = c->next;
+        free(c);
+    }
+}
+
+}
+
 //-----------------------------------------------------------------------------
 // Word-wrap the string for our message box appropriately, and then display
 // that string.
@@ -217,6 +457,154 @@ void BandedMatrix::Solve() {
     }
 }
 
+//-----------------------------------------------------------------------------
+// Factor a sparse symmetric positive semidefinite matrix in place. We pick
+// each pivot as the remaining row with the fewest nonzeros, and eliminate its
+// column from the other rows; the row that's left is the corresponding row
+// of the triangular factor. A pivot no greater than tol means that the row
+// depends on the rows already eliminated, so it's skipped.
+//-----------------------------------------------------------------------------
+void SparseSymmetricMatrix::Clear(int newN) {
+    n = newN;
+    row.resize(n);
+    for(std::vector<Entry> &r : row) {
+        r.clear();
+    }
+    order.clear();
+    pivot.assign(n, 0.0);
+    dependent.assign(n, false);
+    rank = 0;
+}
+
+void SparseSymmetricMatrix::Factor(double tol) {
+    typedef std::pair<int, int> DegreeAndRow;
+    std::priority_queue<DegreeAndRow, std::vector<DegreeAndRow>,
+                        std::greater<DegreeAndRow>> queue;
+    std::vector<bool> done(n, false);
+    std::vector<Entry> merged;
+
+    order.clear();
+    rank = 0;
+    for(int i = 0; i < n; i++) {
+        queue.push({ (int)row[i].size(), i });
+    }
+    while(!queue.empty()) {
+        DegreeAndRow dr = queue.top();
+        queue.pop();
+        int p = dr.second;
+        // The degree changes as we eliminate; so skip the stale entries.
+        if(done[p] || dr.first != (int)row[p].size()) continue;
+        done[p] = true;
+        order.push_back(p);
+
+        const std::vector<Entry> &rp = row[p];
+        double d = 0;
+        for(const Entry &e : rp) {
+            if(e.col == p) d = e.val;
+        }
+        pivot[p] = d;
+        if(d <= tol) {
+            dependent[p] = true;
+            continue;
+        }
+        dependent[p] = false;
+        rank++;
+
+        for(const Entry &e : rp) {
+            int j = e.col;
+            if(j == p || done[j]) continue;
+
+            // row[j] -= (a_jp/a_pp)*row[p], which zeroes column p
+            double f = e.val / d;
+            const std::vector<Entry> &rj = row[j];
+            merged.clear();
+            size_t a = 0, b = 0;
+            while(a < rj.size() || b < rp.size()) {
+                if(b >= rp.size() || (a < rj.size() && rj[a].col < rp[b].col)) {
+                    merged.push_back(rj[a++]);
+                } else if(a >= rj.size() || rp[b].col < rj[a].col) {
+                    merged.push_back({ rp[b].col, -f*rp[b].val });
+                    b++;
+                } else {
+                    merged.push_back({ rj[a].col, rj[a].val - f*rp[b].val });
+                    a++;
+                    b++;
+                }
+                if(merged.back().col == p) merged.pop_back();
+            }
+            row[j].swap(merged);
+            queue.push({ (int)row[j].size(), j });
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Solve M*x = b using the factorization; on entry x holds b. The unknowns
+// that correspond to dependent rows are set to zero.
+//-----------------------------------------------------------------------------
+void SparseSymmetricMatrix::Solve(double *x) const {
+    for(int p : order) {
+        if(dependent[p]) continue;
+        double f = x[p] / pivot[p];
+        for(const Entry &e : row[p]) {
+            if(e.col != p) x[e.col] -= f*e.val;
+        }
+    }
+    for(int p : order) {
+        if(dependent[p]) x[p] = 0;
+    }
+    for(auto it = order.rbegin(); it != order.rend(); ++it) {
+        int p = *it;
+        if(dependent[p]) continue;
+        double temp = x[p];
+        for(const Entry &e : row[p]) {
+            if(e.col != p) temp -= e.val*x[e.col];
+        }
+        x[p] = temp / pivot[p];
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Return b'*M^-1*b, using the factorization; on entry x holds b, and on exit
+// it's garbage. That's the sum of the squares of the forward substitution,
+// weighted by the pivots, so there's no need to substitute back. The
+// dependent rows are ignored.
+//-----------------------------------------------------------------------------
+double SparseSymmetricMatrix::InverseQuadraticForm(double *x) const {
+    double sum = 0;
+    for(int p : order) {
+        if(dependent[p] || EXACT(x[p] == 0)) continue;
+        double f = x[p] / pivot[p];
+        sum += f*x[p];
+        for(const Entry &e : row[p]) {
+            if(e.col != p) x[e.col] -= f*e.val;
+        }
+    }
+    return sum;
+}
+
+//-----------------------------------------------------------------------------
+// Find the vector y in the null space of M with y[p] = 1, where p is one of
+// the dependent rows, and zero in all the other dependent rows. The vectors
+// for all the dependent rows form a basis for the null space.
+//-----------------------------------------------------------------------------
+void SparseSymmetricMatrix::NullVector(int p, double *y) const {
+    ssassert(dependent[p], "Null vector is only defined for a dependent row");
+    for(int i = 0; i < n; i++) {
+        y[i] = 0;
+    }
+    y[p] = 1;
+    for(auto it = order.rbegin(); it != order.rend(); ++it) {
+        int q = *it;
+        if(dependent[q]) continue;
+        double temp = 0;
+        for(const Entry &e : row[q]) {
+            if(e.col != q) temp -= e.val*y[e.col];
+        }
+        y[q] = temp / pivot[q];
+    }
+}
+
 const Quaternion Quaternion::IDENTITY = { 1, 0, 0, 0 };
 
 Quaternion Quaternion::From(double w, double vx, double vy, double vz) {